@@ -2,6 +2,5 @@ notify 20 {
 	match "system"		"ACPI";
 	match "subsystem"	"ACAD";
 	action "/etc/rc.d/power_profile $notify";
-	action "%%BINDIR%%/asmctl video acpi";
-	action "%%BINDIR%%/asmctl key acpi";
+	action "%%BINDIR%%/asmctl all acpi";
 };
@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# PROVIDE: asmctld
+# REQUIRE: LOGIN
+# KEYWORD: shutdown
+#
+# Add the following line to /etc/rc.conf to enable asmctld:
+#
+# asmctld_enable="YES"
+#
+# To follow the AC power status without devd(8) running asmctl(1):
+#
+# asmctld_flags="-a"
+#
+
+. /etc/rc.subr
+
+name="asmctld"
+rcvar="asmctld_enable"
+
+load_rc_config $name
+
+: ${asmctld_enable:="NO"}
+
+command="%%SBINDIR%%/${name}"
+
+run_rc_command "$1"
@@ -29,52 +29,89 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/param.h>
-#include <sys/sysctl.h>
 #include "asmctl.h"
 
-#define KB_CUR_LEVEL "dev.asmc.0.light.control"
+/* names of the unit of asmc(4) */
+#define KB_CUR_LEVEL "dev.asmc.%d.light.control"
 /*
  * 'economy' & 'fullpower' are not actual sysctl name.
  * They are used for the configuration file.
  */
-#define KB_ECO_LEVEL "dev.asmc.0.light.economy"
-#define KB_FUL_LEVEL "dev.asmc.0.light.fullpower"
+#define KB_ECO_LEVEL "dev.asmc.%d.light.economy"
+#define KB_FUL_LEVEL "dev.asmc.%d.light.fullpower"
+
+#define KB_NAMELEN 48
+#define KB_NSTEPS 10
 
 struct acpi_keyboard_context {
+	char akc_cur_key[KB_NAMELEN];
+	char akc_eco_key[KB_NAMELEN];
+	char akc_ful_key[KB_NAMELEN];
 	int akc_economy_level;
 	int akc_fullpower_level;
 	int akc_current_level;
+	struct fade akc_fade;
 };
 
+static int write_keyboard_backlight_level(void *, int);
+
 static int
 get_keyboard_backlight_level(struct acpi_keyboard_context *c)
 {
-	int val;
+	int val, rc;
 	size_t buflen = sizeof(val);
+	struct trace_mark tm;
+
+	/* the target of the fade is the current level */
+	if (fade_is_active(&c->akc_fade))
+		return 0;
 
-	if (sysctlbyname(KB_CUR_LEVEL, &val, &buflen, NULL, 0) < 0) {
-		fprintf(stderr, "sysctl %s : %s\n", KB_CUR_LEVEL,
+	trace_begin(&tm, PHASE_LEVELS);
+	rc = HW_SYSCTL(c->akc_cur_key, &val, &buflen, NULL, 0);
+	trace_end(&tm);
+	if (rc < 0) {
+		fprintf(stderr, "sysctl %s : %s\n", c->akc_cur_key,
 			strerror(errno));
 		return -1;
 	}
 
         if (c->akc_economy_level < 0)
-                c->akc_economy_level = val;
+                conf_set_int(&c->akc_economy_level, val);
 
         if (c->akc_fullpower_level < 0)
-                c->akc_fullpower_level = val;
+                conf_set_int(&c->akc_fullpower_level, val);
 
-	c->akc_current_level = val;
+	conf_set_int(&c->akc_current_level, val);
 	return 0;
 }
 
+/*
+  The units after the first one are found by the light control. The
+  first one is used without checking as ever.
+ */
+static int
+acpi_keyboard_probe(int unit)
+{
+	char name[KB_NAMELEN];
+	int val;
+	size_t buflen = sizeof(val);
+
+	snprintf(name, sizeof(name), KB_CUR_LEVEL, unit);
+	return (unit == 0) ? 0 : HW_SYSCTL(name, &val, &buflen, NULL, 0);
+}
+
 static int
-acpi_keyboard_init(void *context)
+acpi_keyboard_init(void *context, int unit)
 {
 	struct acpi_keyboard_context *c = context;
 
+	snprintf(c->akc_cur_key, sizeof(c->akc_cur_key), KB_CUR_LEVEL, unit);
+	snprintf(c->akc_eco_key, sizeof(c->akc_eco_key), KB_ECO_LEVEL, unit);
+	snprintf(c->akc_ful_key, sizeof(c->akc_ful_key), KB_FUL_LEVEL, unit);
+
 	c->akc_economy_level = -1;
 	c->akc_fullpower_level = -1;
+	fade_init(&c->akc_fade, write_keyboard_backlight_level, c);
 
 	return 0;
 }
@@ -84,9 +121,9 @@ acpi_keyboard_load_conf(void *context, nvlist_t *conf)
 {
 	struct acpi_keyboard_context *c = context;
 
-        if (conf_get_int(conf, KB_CUR_LEVEL, &c->akc_current_level) < 0 ||
-            conf_get_int(conf, KB_ECO_LEVEL, &c->akc_economy_level) < 0 ||
-	    conf_get_int(conf, KB_FUL_LEVEL, &c->akc_fullpower_level) < 0)
+        if (conf_get_int(conf, c->akc_cur_key, &c->akc_current_level) < 0 ||
+            conf_get_int(conf, c->akc_eco_key, &c->akc_economy_level) < 0 ||
+	    conf_get_int(conf, c->akc_ful_key, &c->akc_fullpower_level) < 0)
 		return -1;
 
 	return 0;
@@ -97,9 +134,9 @@ acpi_keyboard_save_conf(void *context, nvlist_t *conf)
 {
 	struct acpi_keyboard_context *c = context;
 
-	nvlist_add_number(conf, KB_CUR_LEVEL, c->akc_current_level);
-	nvlist_add_number(conf, KB_ECO_LEVEL, c->akc_economy_level);
-	nvlist_add_number(conf, KB_FUL_LEVEL, c->akc_fullpower_level);
+	nvlist_add_number(conf, c->akc_cur_key, c->akc_current_level);
+	nvlist_add_number(conf, c->akc_eco_key, c->akc_economy_level);
+	nvlist_add_number(conf, c->akc_ful_key, c->akc_fullpower_level);
 	return 0;
 }
 
@@ -109,7 +146,7 @@ acpi_keyboard_cap_set_rights(void *context, cap_sysctl_limit_t *limits)
 {
 	struct acpi_keyboard_context *c = context;
 
-	cap_sysctl_limit_name(limits, KB_CUR_LEVEL, CAP_SYSCTL_RDWR);
+	hw_sysctl_limit(limits, c->akc_cur_key, CAP_SYSCTL_RDWR);
 
 	return 0;
 }
@@ -123,32 +160,59 @@ acpi_keyboard_cleanup(void *context)
 	return 0;
 }
 
+/* write the brightness, called for each frame of the fade */
 static int
-set_keyboard_backlight_level(struct acpi_keyboard_context *c, int val)
+write_keyboard_backlight_level(void *context, int val)
 {
+	struct acpi_keyboard_context *c = context;
 	int rc;
 	char buf[sizeof(int)];
 
-	if (val < 0 || val > 100)
-		return -1;
-
 	memcpy(buf, &val, sizeof(int));
 
-	rc = sysctlbyname(KB_CUR_LEVEL, NULL, NULL, buf, sizeof(int));
+	rc = HW_SYSCTL(c->akc_cur_key, NULL, NULL, buf, sizeof(int));
 	if (rc < 0) {
-		fprintf(stderr, "sysctl %s : %s\n", KB_CUR_LEVEL,
+		fprintf(stderr, "sysctl %s : %s\n", c->akc_cur_key,
 			strerror(errno));
 		return rc;
 	}
+	conf_count(STAT_HW_WRITES, 1);
+
+	return 0;
+}
+
+/*
+  Set the level. The same level as the current one is not written unless
+  ASMC_SET_FORCE is set, the hardware may be reset by a boot, a resume or
+  the firmware on an AC power change. The level for the AC power status
+  is kept with ASMC_SET_CURRENT.
+ */
+static int
+set_keyboard_backlight_level(struct acpi_keyboard_context *c, int val,
+			     int flags)
+{
+	int rc;
 
-	printf("set keyboard backlight brightness: %d\n", val);
+	if (val < 0 || val > 100)
+		return -1;
+
+	/* skip writing the same level, or write it at once */
+	if (val == c->akc_current_level && ! (flags & ASMC_SET_FORCE))
+		conf_count(STAT_HW_WRITES_SKIPPED, 1);
+	else if ((rc = fade_to(&c->akc_fade, (val == c->akc_current_level) ?
+			       -1 : c->akc_current_level, val)) < 0)
+		return rc;
 
-	c->akc_current_level = val;
+	output_text("set keyboard backlight brightness: %d\n", val);
+
+	conf_set_int(&c->akc_current_level, val);
+	if (flags & ASMC_SET_CURRENT)
+		return 0;
 
 	if (ac_powered)
-		c->akc_fullpower_level = val;
+		conf_set_int(&c->akc_fullpower_level, val);
 	else
-		c->akc_economy_level = val;
+		conf_set_int(&c->akc_economy_level, val);
 
 	return 0;
 }
@@ -160,33 +224,79 @@ acpi_keyboard_event(void *context)
 	int alv = choose_acpi_level(c->akc_economy_level,
 				    c->akc_fullpower_level);
 
-	return set_keyboard_backlight_level(c, alv);
+	return set_keyboard_backlight_level(c, alv, ASMC_SET_FORCE);
 }
 
 static int
-acpi_keyboard_up(void *context)
+acpi_keyboard_up(void *context, int steps)
 {
 	struct acpi_keyboard_context *c = context;
-	int d;
 
 	if (get_keyboard_backlight_level(c) < 0)
 		return -1;
 
-	d = MIN(c->akc_current_level + 10, 100);
-	return set_keyboard_backlight_level(c, d);
+	return set_keyboard_backlight_level(c, level_curve_step(NULL,
+		KB_NSTEPS, c->akc_current_level, steps), 0);
 }
 
 static int
-acpi_keyboard_down(void *context)
+acpi_keyboard_down(void *context, int steps)
 {
 	struct acpi_keyboard_context *c = context;
-	int d;
 
 	if (get_keyboard_backlight_level(c) < 0)
 		return -1;
 
-	d = MAX(c->akc_current_level - 10, 0);
-	return set_keyboard_backlight_level(c, d);
+	return set_keyboard_backlight_level(c, level_curve_step(NULL,
+		KB_NSTEPS, c->akc_current_level, -steps), 0);
+}
+
+/* any level in 0..100 is accepted, that is the percentage as well */
+static int
+acpi_keyboard_set(void *context, int val, int flags)
+{
+	struct acpi_keyboard_context *c = context;
+
+	return set_keyboard_backlight_level(c, MAX(0, MIN(val, 100)),
+					    flags & ASMC_SET_CURRENT);
+}
+
+static int
+acpi_keyboard_get_levels(void *context, struct asmc_levels *l)
+{
+	struct acpi_keyboard_context *c = context;
+
+	l->al_current = c->akc_current_level;
+	l->al_economy = c->akc_economy_level;
+	l->al_fullpower = c->akc_fullpower_level;
+	return 0;
+}
+
+static int
+acpi_keyboard_read_level(void *context, int *val)
+{
+	struct acpi_keyboard_context *c = context;
+	size_t buflen = sizeof(*val);
+
+	if (HW_SYSCTL(c->akc_cur_key, val, &buflen, NULL, 0) < 0) {
+		fprintf(stderr, "sysctl %s : %s\n", c->akc_cur_key,
+			strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* fade to 0 while idle and back, the current level is kept */
+static int
+acpi_keyboard_dim(void *context, int dim)
+{
+	struct acpi_keyboard_context *c = context;
+
+	if (c->akc_current_level <= 0)
+		return 0;
+
+	return dim ? fade_to(&c->akc_fade, c->akc_current_level, 0) :
+		fade_to(&c->akc_fade, 0, c->akc_current_level);
 }
 
 struct asmc_driver acpi_keyboard_driver =
@@ -194,6 +304,7 @@ struct asmc_driver acpi_keyboard_driver =
 	.name = "acpi_keyboard",
 	.category = KEYBOARD,
 	.ctx_size = sizeof(struct acpi_keyboard_context),
+	.probe = acpi_keyboard_probe,
 	.init = acpi_keyboard_init,
 	.load_conf = acpi_keyboard_load_conf,
 	.save_conf = acpi_keyboard_save_conf,
@@ -203,5 +314,9 @@ struct asmc_driver acpi_keyboard_driver =
 	.cleanup = acpi_keyboard_cleanup,
 	.acpi_event = acpi_keyboard_event,
 	.up = acpi_keyboard_up,
-	.down = acpi_keyboard_down
+	.down = acpi_keyboard_down,
+	.set = acpi_keyboard_set,
+	.get_levels = acpi_keyboard_get_levels,
+	.read_level = acpi_keyboard_read_level,
+	.dim = acpi_keyboard_dim
 };
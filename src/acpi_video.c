@@ -31,7 +31,6 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/param.h>
-#include <sys/sysctl.h>
 
 #include "asmctl.h"
 
@@ -45,18 +44,25 @@ struct acpi_video_context {
 	int avc_economy_level;
 	int avc_fullpower_level;
 	int avc_current_level;
-	int avc_nlevels;
-	int *avc_levels;
+	struct level_table avc_table;
+	struct fade avc_fade;
 };
 
+static int write_acpi_video_level(void *, int);
+
 static int
-acpi_video_init(void *context)
+acpi_video_init(void *context, int unit)
 {
 	struct acpi_video_context *c = context;
 
+	/* lcd0 only */
+	if (unit > 0)
+		return -1;
+
 	c->avc_fullpower_level = -1;
 	c->avc_economy_level = -1;
 	c->avc_current_level = -1;
+	fade_init(&c->avc_fade, write_acpi_video_level, c);
 
 	return 0;
 }
@@ -91,10 +97,10 @@ acpi_video_cap_set_rights(void *context, cap_sysctl_limit_t *limits)
 {
 	struct acpi_video_context *c = context;
 
-	cap_sysctl_limit_name(limits, ACPI_VIDEO_LEVELS, CAP_SYSCTL_READ);
-	cap_sysctl_limit_name(limits, ACPI_VIDEO_ECO_LEVEL, CAP_SYSCTL_RDWR);
-	cap_sysctl_limit_name(limits, ACPI_VIDEO_FUL_LEVEL, CAP_SYSCTL_RDWR);
-	cap_sysctl_limit_name(limits, ACPI_VIDEO_CUR_LEVEL, CAP_SYSCTL_RDWR);
+	hw_sysctl_limit(limits, ACPI_VIDEO_LEVELS, CAP_SYSCTL_READ);
+	hw_sysctl_limit(limits, ACPI_VIDEO_ECO_LEVEL, CAP_SYSCTL_RDWR);
+	hw_sysctl_limit(limits, ACPI_VIDEO_FUL_LEVEL, CAP_SYSCTL_RDWR);
+	hw_sysctl_limit(limits, ACPI_VIDEO_CUR_LEVEL, CAP_SYSCTL_RDWR);
 
 	return 0;
 }
@@ -105,7 +111,6 @@ acpi_video_cleanup(void *context)
 {
 	struct acpi_video_context *c = context;
 
-	free(c->avc_levels);
 	return 0;
 }
 
@@ -115,13 +120,17 @@ compare_video_levels(const void *a, const void *b)
 	return (*(int*)a - *(int*)b);
 }
 
+/*
+  Retrieve the levels from the kernel. The first two elements are the
+  default levels for fullpower and economy, and the rest are sorted.
+ */
 static int
-get_acpi_video_levels(struct acpi_video_context *c)
+fetch_acpi_video_levels(int **levels)
 {
-	int *buf, rc, *v, n;
+	int *buf, rc, n;
 	size_t buflen = -1;
 
-	rc = sysctlbyname(ACPI_VIDEO_LEVELS, NULL, &buflen, NULL, 0);
+	rc = HW_SYSCTL(ACPI_VIDEO_LEVELS, NULL, &buflen, NULL, 0);
 	if (rc < 0) {
 		fprintf(stderr, "sysctl %s : %s\n", ACPI_VIDEO_LEVELS,
 			strerror(errno));
@@ -140,7 +149,7 @@ get_acpi_video_levels(struct acpi_video_context *c)
 		return -1;
 	}
 
-	rc = sysctlbyname(ACPI_VIDEO_LEVELS, (void *)buf, &buflen, NULL, 0);
+	rc = HW_SYSCTL(ACPI_VIDEO_LEVELS, (void *)buf, &buflen, NULL, 0);
 	if (rc < 0) {
 		fprintf(stderr, "sysctl %s : %s\n", ACPI_VIDEO_LEVELS,
 			strerror(errno));
@@ -155,131 +164,204 @@ get_acpi_video_levels(struct acpi_video_context *c)
 		return -1;
 	}
 
+	/* ignore first two elements for range */
+	qsort(&buf[2], n - 2, sizeof(int), compare_video_levels);
+
+	*levels = buf;
+	return n;
+}
+
+static int
+get_acpi_video_levels(struct acpi_video_context *c)
+{
+	int *buf, n, rc;
+	struct trace_mark tm;
+
+	/* already retrieved, asmctld(8) keeps them in memory. */
+	if (c->avc_table.lt_nlevels > 0)
+		return 0;
+
+	/*
+	  The levels are not cached in the file. Nothing tells the table
+	  of the firmware has changed without retrieving it.
+	 */
+	trace_begin(&tm, PHASE_LEVELS);
+	n = fetch_acpi_video_levels(&buf);
+	trace_end(&tm);
+	if (n < 0)
+		return -1;
+
 	/* if conf_file is empty or not created,
 	   use default value */
 	if (c->avc_fullpower_level < 0)
-		c->avc_fullpower_level = (int)buf[0];
+		conf_set_int(&c->avc_fullpower_level, (int)buf[0]);
 
 	if (c->avc_economy_level < 0)
-		c->avc_economy_level = (int)buf[1];
+		conf_set_int(&c->avc_economy_level, (int)buf[1]);
 
 	if (c->avc_current_level < 0)
-		c->avc_current_level = ac_powered ?
-			c->avc_fullpower_level : c->avc_economy_level;
+		conf_set_int(&c->avc_current_level, ac_powered ?
+			     c->avc_fullpower_level : c->avc_economy_level);
 
 	/* ignore first two elements for range */
-	n -= 2;
-	if ((v = malloc(n * sizeof(int))) == NULL) {
-		fprintf(stderr, "failed to allocate %zu bytes memory\n",
-			n * sizeof(int));
-		free(buf);
-		return -1;
-	}
+	rc = level_table_init(&c->avc_table, &buf[2], n - 2);
 
-	memcpy(v, &buf[2], n * sizeof(int));
-
-	qsort(v, n, sizeof(int), compare_video_levels);
-
-	c->avc_nlevels = n;
-	c->avc_levels = v;
+	/* acpi_video(4) accepts only the levels */
+	fade_set_levels(&c->avc_fade, &c->avc_table);
 
 	free(buf);
 
 	return rc;
 }
 
+/* write the brightness, called for each frame of the fade */
 static int
-set_acpi_video_level(struct acpi_video_context *c, int val) {
+write_acpi_video_level(void *context, int val)
+{
+	char buf[sizeof(int)];
+
+	memcpy(buf, &val, sizeof(int));
+
+	if (HW_SYSCTL(ACPI_VIDEO_CUR_LEVEL, NULL, NULL, buf,
+			 sizeof(int)) < 0) {
+		fprintf(stderr, "sysctl %s : %s\n", ACPI_VIDEO_CUR_LEVEL,
+			strerror(errno));
+		return -1;
+	}
+	conf_count(STAT_HW_WRITES, 1);
+
+	return 0;
+}
+
+/*
+  Set the level. The same levels as the saved ones are not written unless
+  ASMC_SET_FORCE is set, the hardware may be reset by a boot, a resume or
+  the firmware on an AC power change. The level for the AC power status
+  is kept with ASMC_SET_CURRENT.
+ */
+static int
+set_acpi_video_level(struct acpi_video_context *c, int val, int flags) {
 	char *key;
-	int rc;
+	int rc, *lvp;
 	char buf[sizeof(int)];
+	struct trace_mark tm;
 
 	if (val < 0 || val > 100)
 		return -1;
 
 	memcpy(buf, &val, sizeof(int));
 
-	rc = sysctlbyname(ACPI_VIDEO_CUR_LEVEL, NULL, NULL, buf, sizeof(int));
-	if (rc < 0) {
-		fprintf(stderr, "sysctl %s : %s\n", ACPI_VIDEO_CUR_LEVEL,
-			strerror(errno));
+	/* skip writing the same level, or write it at once */
+	if (val == c->avc_current_level && ! (flags & ASMC_SET_FORCE))
+		conf_count(STAT_HW_WRITES_SKIPPED, 1);
+	else if ((rc = fade_to(&c->avc_fade, (val == c->avc_current_level) ?
+			       -1 : c->avc_current_level, val)) < 0)
 		return rc;
-	}
 
-	printf("set video brightness: %d\n", val);
+	output_text("set video brightness: %d\n", val);
 
-	key = (ac_powered) ? ACPI_VIDEO_FUL_LEVEL : ACPI_VIDEO_ECO_LEVEL;
+	conf_set_int(&c->avc_current_level, val);
+	if (flags & ASMC_SET_CURRENT)
+		return 0;
 
-	rc = sysctlbyname(key, NULL, NULL, buf, sizeof(int));
-	if (rc < 0) {
-		fprintf(stderr, "sysctl %s : %s\n", key, strerror(errno));
-		return rc;
+	if (ac_powered) {
+		key = ACPI_VIDEO_FUL_LEVEL;
+		lvp = &c->avc_fullpower_level;
+	} else {
+		key = ACPI_VIDEO_ECO_LEVEL;
+		lvp = &c->avc_economy_level;
 	}
 
-	c->avc_current_level = val;
+	if (val == *lvp && ! (flags & ASMC_SET_FORCE))
+		conf_count(STAT_HW_WRITES_SKIPPED, 1);
+	else {
+		trace_begin(&tm, PHASE_WRITE);
+		rc = HW_SYSCTL(key, NULL, NULL, buf, sizeof(int));
+		trace_end(&tm);
+		if (rc < 0) {
+			fprintf(stderr, "sysctl %s : %s\n", key,
+				strerror(errno));
+			return rc;
+		}
+		conf_count(STAT_HW_WRITES, 1);
+	}
 
-	if (ac_powered)
-		c->avc_fullpower_level = val;
-	else
-		c->avc_economy_level = val;
+	conf_set_int(lvp, val);
 
 	return 0;
 }
 
 static int
-get_video_up_level(struct acpi_video_context *c)
+acpi_video_event(void *context)
 {
-	int v = c->avc_current_level;
-	int i, *p;
+	struct acpi_video_context *c = context;
+	int alv = choose_acpi_level(c->avc_economy_level,
+				    c->avc_fullpower_level);
 
-	for (i = 0; i < c->avc_nlevels; i++)
-		if (c->avc_levels[i] == v)
-			return c->avc_levels[MIN(i + 1, c->avc_nlevels - 1)];
+	/* the fade steps over the levels */
+	if (fade_duration > 0)
+		get_acpi_video_levels(c);
 
-	return -1;
+	return set_acpi_video_level(c, alv, ASMC_SET_FORCE);
 }
 
 static int
-get_video_down_level(struct acpi_video_context *c)
+acpi_video_up(void *context, int steps)
 {
-	int v = c->avc_current_level;
-	int i;
-
-	for (i = c->avc_nlevels - 1; i >= 0; i--)
-		if (c->avc_levels[i] == v)
-			return c->avc_levels[MAX(0, i - 1)];
+	struct acpi_video_context *c = context;
 
-	return -1;
+	if (get_acpi_video_levels(c) < 0)
+		return -1;
+	return set_acpi_video_level(c, level_curve_step(&c->avc_table,
+		c->avc_table.lt_nlevels - 1, c->avc_current_level, steps), 0);
 }
 
 static int
-acpi_video_event(void *context)
+acpi_video_down(void *context, int steps)
 {
 	struct acpi_video_context *c = context;
-	int alv = choose_acpi_level(c->avc_economy_level,
-				    c->avc_fullpower_level);
 
-	return set_acpi_video_level(c, alv);
+	if (get_acpi_video_levels(c) < 0)
+		return -1;
+	return set_acpi_video_level(c, level_curve_step(&c->avc_table,
+		c->avc_table.lt_nlevels - 1, c->avc_current_level, -steps), 0);
 }
 
 static int
-acpi_video_up(void *context)
+acpi_video_set(void *context, int val, int flags)
 {
 	struct acpi_video_context *c = context;
 
 	if (get_acpi_video_levels(c) < 0)
 		return -1;
-	return set_acpi_video_level(c, get_video_up_level(c));
+	return set_acpi_video_level(c, (flags & ASMC_SET_PERCENT) ?
+				    level_percent(&c->avc_table, val) :
+				    level_nearest(&c->avc_table, val),
+				    flags & ASMC_SET_CURRENT);
 }
 
 static int
-acpi_video_down(void *context)
+acpi_video_get_levels(void *context, struct asmc_levels *l)
 {
 	struct acpi_video_context *c = context;
 
-	if (get_acpi_video_levels(c) < 0)
+	l->al_current = c->avc_current_level;
+	l->al_economy = c->avc_economy_level;
+	l->al_fullpower = c->avc_fullpower_level;
+	return 0;
+}
+
+static int
+acpi_video_read_level(void *context, int *val)
+{
+	size_t buflen = sizeof(*val);
+
+	if (HW_SYSCTL(ACPI_VIDEO_CUR_LEVEL, val, &buflen, NULL, 0) < 0) {
+		fprintf(stderr, "sysctl %s : %s\n", ACPI_VIDEO_CUR_LEVEL,
+			strerror(errno));
 		return -1;
-	return set_acpi_video_level(c, get_video_down_level(c));
+	}
+	return 0;
 }
 
 struct asmc_driver acpi_video_driver =
@@ -296,5 +378,8 @@ struct asmc_driver acpi_video_driver =
 	.cleanup = acpi_video_cleanup,
 	.acpi_event = acpi_video_event,
 	.up = acpi_video_up,
-	.down = acpi_video_down
+	.down = acpi_video_down,
+	.set = acpi_video_set,
+	.get_levels = acpi_video_get_levels,
+	.read_level = acpi_video_read_level
 };
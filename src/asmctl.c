@@ -32,417 +32,387 @@
  * This command may require the following sysctl variables:
  *
  *  hw.acpi.video.lcd0.*	(acpi_video(4))
- *  hw.asmc.0.light.control	(asmc(4))
+ *  dev.asmc.<N>.light.control	(asmc(4))
  *  hw.acpi.acline		(acpi(4))
  *
- * If a backlight(9) device is available, the following device file is
+ * If backlight(9) devices are available, the following device files are
  * used instead of 'hw.acpi.video.lcd0.*'.
  *
- *  /dev/backlight/backlight0
+ *  /dev/backlight/backlight<N>
  *
  */
 
 #include <errno.h>
-#include <fcntl.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
-#include <sys/sysctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include "asmctl.h"
 
-#define AC_POWER "hw.acpi.acline"
-
-/* set 1 if AC powered else 0 */
-int ac_powered = 0;
-
-/* file name to save state */
-static char *conf_filename = "/var/lib/asmctl.conf";
-
-/* file descriptor for the state file */
-static int conf_fd = -1;
-
-/* available drivers. */
-static struct asmc_driver *asmc_drivers[] = {
-#ifdef HAVE_SYS_BACKLIGHT_H
-    &backlight_driver,
-#endif
-    &acpi_video_driver, &acpi_keyboard_driver
-};
-
-/* driver context for video & keyboard. */
-static struct asmc_driver_context video_ctx, keyboard_ctx;
-
-/*
-  available subcommands.
-  MUST be sorted by name.
-*/
-static struct driver_type {
-	char *name;
-	struct asmc_driver_context *context;
-} type_table[] = {
-	{"kb", &keyboard_ctx},
-	{"kbd", &keyboard_ctx},
-	{"key", &keyboard_ctx},
-	{"keyboard", &keyboard_ctx},
-	{"lcd", &video_ctx},
-	{"video", &video_ctx},
-};
-
-/*
-  lookup up an asmc driver of the category. returns the first
-  match and successfully initialized driver in 'asmc_drivers'.
- */
-static int
-lookup_driver(enum CATEGORY cat, struct asmc_driver **drv, void **ctx)
-{
-	struct asmc_driver *ad, **p;
-	void *c;
-
-	ARRAY_FOREACH(p, asmc_drivers) {
-		ad = *p;
-		if (ad->category != cat)
-			continue;
-		if ((c = calloc(1, ad->ctx_size)) == NULL) {
-			fprintf(stderr,
-				"failed to allocate %zu bytes memory\n",
-				ad->ctx_size);
-			return -1;
-		}
-		if (ad->init(c) < 0) {
-			free(c);
-			continue;
-		}
-		*drv = ad;
-		*ctx = c;
-		return 0;
-	}
-	return -1;
-}
-
-/* clean up the driver context */
-static void cleanup_driver_context(struct asmc_driver_context *c)
-{
-	ASMC_CLEANUP(c);
-	free(c->context);
-}
-
-/* initialize video & keyboard backlight drivers. */
-static int
-init_driver_context()
+static void
+usage(const char *prog)
 {
-	if (lookup_driver(KEYBOARD, &keyboard_ctx.driver,
-			  &keyboard_ctx.context) < 0)
-		return -1;
-	if (lookup_driver(VIDEO, &video_ctx.driver, &video_ctx.context) < 0) {
-		cleanup_driver_context(&keyboard_ctx);
-		return -1;
-	}
-	return 0;
+	printf("usage: %s [--json|-q] [--trace] [-A msec] [-C curve[:steps]] "
+	       "[-F msec] [-D dir] [-S sysfs] [video|key|all][:unit] "
+	       "[up|down] [steps] ...\n", prog);
+	printf("       %s [--json|-q] [--trace] [-A msec] [-C curve[:steps]] "
+	       "[-F msec] [-D dir] [-S sysfs] [video|key|all][:unit] "
+	       "set level[%%] ...\n", prog);
+	printf("       %s [--json|-q] [--trace] [-A msec] [-C curve[:steps]] "
+	       "[-F msec] [-D dir] [-S sysfs] -f file|-\n", prog);
+	printf("       %s [--json] status [video|key|all][:unit] [--verify]\n",
+	       prog);
+	printf("       %s export|stats\n", prog);
+	printf("\nChange video or keyboard backlight more or less bright.\n");
 }
 
-/**
-   Store backlight levels to file.
-   Write in sysctl.conf(5) format to restore by sysctl(1)
+/*
+  Send the command to asmctld(8) if it is running, the output of the
+  daemon follows the first line of the reply. The options for the
+  command precede it in 'opts'.
+  Returns the exit status, or -1 if the daemon is not available.
  */
 static int
-store_conf_file()
+client_request(const char *opts, int argc, char *argv[])
 {
-	FILE *fp;
-	nvlist_t *nl;
-	const char *name;
-	int type;
-	void *cookie;
-
-	if (conf_fd < 0)
-		return -1;
-
-	if ((nl = nvlist_create(0)) == NULL) {
-		fprintf(stderr, "nvlist_create: %s\n", strerror(errno));
-		return -1;
-	}
-	ASMC_SAVE(&keyboard_ctx, nl);
-	ASMC_SAVE(&video_ctx, nl);
-
-	if (ftruncate(conf_fd, 0) < 0) {
-		fprintf(stderr, "ftruncate: %s\n", strerror(errno));
-		goto err;
-	}
-
-	if (lseek(conf_fd, 0, SEEK_SET) < 0) {
-		fprintf(stderr, "lseek: %s\n", strerror(errno));
-		goto err;
-	}
-
-	if ((fp = fdopen(conf_fd, "w")) == NULL) {
-		fprintf(stderr, "can not write %s\n", conf_filename);
-		goto err;
-	}
-	fprintf(fp, "# DO NOT EDIT MANUALLY!\n"
-		    "# This file is written by asmctl.\n");
-	cookie = NULL;
-	while ((name = nvlist_next(nl, &type, &cookie)) != NULL) {
-		if (type != NV_TYPE_NUMBER)
-			continue;
-		fprintf(fp, "%s=%d\n", name, (int)nvlist_get_number(nl, name));
-	}
-	nvlist_destroy(nl);
-
-	if (fdclose(fp, NULL) < 0) {
-		fprintf(stderr, "can not write %s\n", conf_filename);
-		return -1;
-	}
-
-	return 0;
-err:
-	nvlist_destroy(nl);
-	return -1;
-}
-
-/* utility: check and get the number from the key. */
-int
-conf_get_int(nvlist_t *conf, const char *key, int *val)
-{
-	if (! nvlist_exists_number(conf, key))
-		return -1;
-	*val = nvlist_get_number(conf, key);
-	return 0;
-}
-
-/* utility: choose the brightness level on an acpi event */
-int
-choose_acpi_level(int eco, int full)
-{
-	return (ac_powered) ? (MAX(eco, full)) : (MIN(eco, full));
-}
-
-static int
-get_saved_levels()
-{
-	FILE *fp;
-	char buf[128];
-	char name[80];
+	struct sockaddr_un sun;
+	struct timeval tv;
+	char buf[ASMCTLD_MSGSIZE];
 	char *p;
-	int value, len;
-	nvlist_t *nl;
-
-	if (conf_fd < 0)
-		return -1;
-
-	if (lseek(conf_fd, 0, SEEK_SET) < 0) {
-		fprintf(stderr, "lseek: %s\n", strerror(errno));
-		return -1;
+	ssize_t len;
+	int i, s;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_LOCAL;
+	strlcpy(sun.sun_path, ASMCTLD_SOCKET, sizeof(sun.sun_path));
+
+	/* the daemon writes the output as well */
+	strlcpy(buf, (output_mode == OUTPUT_JSON) ? ASMCTLD_JSON " " :
+		(output_mode == OUTPUT_QUIET) ? ASMCTLD_QUIET " " : "",
+		sizeof(buf));
+	strlcat(buf, opts, sizeof(buf));
+	for (i = 0; i < argc; i++) {
+		if (i > 0)
+			strlcat(buf, " ", sizeof(buf));
+		if (strlcat(buf, argv[i], sizeof(buf)) >= sizeof(buf))
+			return -1;
 	}
 
-	if ((fp = fdopen(conf_fd, "r")) == NULL) {
-		fprintf(stderr, "can not read %s\n", conf_filename);
+	if ((s = TRACED(socket(PF_LOCAL, SOCK_SEQPACKET, 0))) < 0)
 		return -1;
-	}
-
-	if ((nl = nvlist_create(0)) == NULL) {
-		fprintf(stderr, "nvlist_create: %s\n", conf_filename);
-		fdclose(fp, NULL);
+	if (TRACED(connect(s, (struct sockaddr *)&sun, sizeof(sun))) < 0) {
+		/* not running, fall back to control devices by myself. */
+		TRACED(close(s));
 		return -1;
 	}
 
-	while (fgets(buf, sizeof(buf), fp) != NULL) {
-		if (buf[0] == '#')
-			continue;
-		p = strchr(buf, '=');
-		if (p == NULL)
-			continue;
-		len = p - buf;
-		len = (len < sizeof(name) - 1) ? len : sizeof(name) - 1;
-		strncpy(name, buf, len);
-		name[len] = '\0';
-		value = strtol(p + 1, &p, 10);
-		if (*p != '\n')
-			continue;
-		nvlist_add_number(nl, name, value);
+	/* a stuck daemon doesn't hang the keypress */
+	tv.tv_sec = ASMCTLD_REPLY_TIMEOUT / 1000;
+	tv.tv_usec = ASMCTLD_REPLY_TIMEOUT % 1000 * 1000;
+	if (TRACED(setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv,
+			      sizeof(tv))) < 0 ||
+	    TRACED(setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv,
+			      sizeof(tv))) < 0 ||
+	    TRACED(send(s, buf, strlen(buf), 0)) < 0 ||
+	    (len = TRACED(recv(s, buf, sizeof(buf) - 1, 0))) <= 0) {
+		fprintf(stderr, "asmctld: %s\n", strerror(errno));
+		TRACED(close(s));
+		return 1;
 	}
-	ASMC_LOAD(&keyboard_ctx, nl);
-	ASMC_LOAD(&video_ctx, nl);
+	TRACED(close(s));
+	buf[len] = '\0';
 
-	nvlist_destroy(nl);
-	if (fdclose(fp, NULL) < 0) {
-		fprintf(stderr, "can not write %s\n", conf_filename);
-		return -1;
+	if (strncmp(buf, ASMCTLD_OK, strlen(ASMCTLD_OK)) == 0) {
+		if ((p = strchr(buf, '\n')) != NULL && p[1] != '\0' &&
+		    TRACED(write(STDOUT_FILENO, p + 1, strlen(p + 1))) < 0)
+			return 1;
+		return 0;
 	}
-
-	return 0;
+	fprintf(stderr, "asmctld: %s\n", buf);
+	return 1;
 }
 
+/*
+  Print the levels saved in the state file. The hardware, casper(3) and
+  the AC power status are not used unless 'verify' is set.
+ */
 static int
-get_ac_powered()
+status(int argc, char *argv[], int verify)
 {
-	char buf[128];
-	size_t buflen = sizeof(buf);
-
-	if (sysctlbyname(AC_POWER, buf, &buflen, NULL, 0) < 0) {
-		fprintf(stderr, "sysctl %s : %s\n", AC_POWER, strerror(errno));
-		return -1;
+	enum CATEGORY cat = NONE;
+	int unit = -1, rc;
+
+	for (; argc > 0; argc--, argv++) {
+		if (strcmp(argv[0], "--verify") == 0)
+			verify = 1;
+		else if (cat != NONE || (strcmp(argv[0], "all") != 0 &&
+			 lookup_category(argv[0], &cat, &unit) < 0))
+			return -1;
 	}
 
-	ac_powered = *((int *)buf);
-
-	return 0;
-}
+	if (open_conf_file() < 0)
+		return 1;
 
+	/* the drivers read the hardware */
+	if (verify) {
+		open_cache_file();
+		rc = (cat == NONE) ? init_driver_context() :
+			init_units(cat, unit);
+		if (rc < 0) {
+			fprintf(stderr, "no driver is found\n");
+			goto err;
+		}
 #ifdef USE_CAPSICUM
-
-/* Global channel to the sysctl caspter.*/
-cap_channel_t *ch_sysctl;
-
-static int
-init_capsicum(struct asmc_driver_context *c)
-{
-	cap_sysctl_limit_t *limits;
-	cap_channel_t *ch_casper;
-	cap_rights_t conf_fd_rights;
-
-#ifdef HAVE_CAPSICUM_HELPERS_H
-	caph_cache_catpages();
-#else
-	catopen("libc", NL_CAT_LOCALE);
+		if (init_capsicum() < 0)
+			goto err;
 #endif
-
-	/* Open a channel to casperd */
-	if ((ch_casper = cap_init()) == NULL) {
-		fprintf(stderr, "cap_init() failed\n");
-		return -1;
 	}
 
-	/* Enter capability mode */
-	if (cap_enter() < 0) {
-		fprintf(stderr, "capability is not supported\n");
-		cap_close(ch_casper);
-		return -1;
-	}
-
-	/* limit conf_fd to read/write/seek/fcntl/ftruncate */
-	/* fcntl is used in fdopen(3) */
-	cap_rights_init(&conf_fd_rights, CAP_READ | CAP_WRITE | CAP_SEEK |
-					     CAP_FCNTL | CAP_FTRUNCATE);
-	if (cap_rights_limit(conf_fd, &conf_fd_rights) < 0) {
-		fprintf(stderr, "cap_rights_limit() failed\n");
-		cap_close(ch_casper);
-		return -1;
-	}
-
-	/* open channel to casper sysctl */
-	if ((ch_sysctl = cap_service_open(ch_casper, "system.sysctl")) == NULL) {
-		fprintf(stderr, "cap_service_open(\"system.sysctl\") failed\n");
-		cap_close(ch_casper);
-		return -1;
-	}
-
-	/* limit sysctl names */
-	limits = cap_sysctl_limit_init(ch_sysctl);
-	cap_sysctl_limit_name(limits, AC_POWER, CAP_SYSCTL_READ);
-
-	/* set rights for the drivers */
-	ASMC_SET_RIGHTS(&keyboard_ctx, limits);
-	ASMC_SET_RIGHTS(&video_ctx, limits);
-
-	if (cap_sysctl_limit(limits) < 0) {
-		cap_sysctl_limit_destroy(limits);
-		fprintf(stderr, "cap_sysctl_limit failed %s\n",
-			strerror(errno));
-		cap_close(ch_casper);
-		cap_close(ch_sysctl);
-		return -1;
-	}
-
-	cap_sysctl_limit_destroy(limits);
-
-	/* close connection to casper */
-	cap_close(ch_casper);
-
-	return 0;
+	rc = asmc_status(cat, unit, verify);
+	output_write(STDOUT_FILENO);
+	cleanup();
+	return (rc < 0) ? 1 : 0;
+err:
+	cleanup();
+	return 1;
 }
-#endif
 
+/* the option is sent to asmctld(8) as well */
 static void
-usage(const char *prog)
+add_option(char *opts, size_t size, const char *name, const char *arg)
 {
-	printf("usage: %s [video|key] [up|down]\n", prog);
-	printf("\nChange video or keyboard backlight more or less bright.\n");
+	strlcat(opts, name, size);
+	strlcat(opts, " ", size);
+	strlcat(opts, arg, size);
+	strlcat(opts, " ", size);
 }
 
 static void
-cleanup()
-{
-	cleanup_driver_context(&keyboard_ctx);
-	cleanup_driver_context(&video_ctx);
-	if (conf_fd != -1)
-		close(conf_fd);
-}
-
-static int
-type_compare(const void *a, const void *b)
+print_trace(void)
 {
-	const char *s = a;
-	const struct driver_type *t = b;
-	return strcmp(s, t->name);
+	trace_print(stderr);
 }
 
 int
 main(int argc, char *argv[])
 {
-	int rc = 0;
-	struct driver_type *type;
-	struct asmc_driver_context *ctx;
+	int ch, rc, leader, override = 0, verify = 0;
+	uid_t euid;
+	char buf[BATCH_MAXSCRIPT], *words[BATCH_MAXARGS];
+	char opts[ASMCTLD_MSGSIZE] = "";
+	long msec;
+	struct asmc_batch batch;
+	struct trace_mark tm;
+	const char *prog = argv[0], *script = NULL;
+	static struct option longopts[] = {
+		{"json", no_argument, NULL, 'j'},
+		{"trace", no_argument, NULL, 't'},
+		{"verify", no_argument, NULL, 'v'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((ch = getopt_long(argc, argv, "A:C:D:F:f:qS:", longopts, NULL)) != -1) {
+		switch (ch) {
+		case 'A':
+			if (parse_msec(optarg, &ac_cache_msec) < 0) {
+				usage(prog);
+				return 1;
+			}
+			add_option(opts, sizeof(opts), ASMCTLD_AC_CACHE,
+				   optarg);
+			break;
+		case 'j':
+			output_mode = OUTPUT_JSON;
+			break;
+		case 'q':
+			output_mode = OUTPUT_QUIET;
+			break;
+		case 'v':
+			verify = 1;
+			break;
+		case 't':
+			/* printed on exit */
+			trace_init();
+			atexit(print_trace);
+			break;
+		case 'C':
+			if (parse_curve(optarg) < 0) {
+				usage(prog);
+				return 1;
+			}
+			add_option(opts, sizeof(opts), ASMCTLD_CURVE, optarg);
+			break;
+		case 'D':
+			/* don't let users open any devices as root */
+			if (getuid() != geteuid()) {
+				fprintf(stderr, "-D is not allowed for setuid\n");
+				return 1;
+			}
+			backlight_dir = optarg;
+			override = 1;
+			break;
+		case 'F':
+			if (parse_msec(optarg, &msec) < 0) {
+				usage(prog);
+				return 1;
+			}
+			fade_duration = msec;
+			add_option(opts, sizeof(opts), ASMCTLD_FADE, optarg);
+			break;
+		case 'f':
+			script = optarg;
+			break;
+		case 'S':
+			/* don't let users write any files as root */
+			if (getuid() != geteuid()) {
+				fprintf(stderr, "-S is not allowed for setuid\n");
+				return 1;
+			}
+			sysfs_root = optarg;
+			override = 1;
+			break;
+		default:
+			usage(prog);
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	/* asmctld(8) stores the levels on every change */
+	if (argc >= 1 && strcmp(argv[0], "status") == 0) {
+		if ((rc = status(argc - 1, &argv[1], verify)) < 0)
+			usage(prog);
+		return (rc == 0) ? 0 : 1;
+	}
 
-	if (argc < 3) {
-		usage(argv[0]);
-		return 1;
+	if (argc == 1 && (strcmp(argv[0], "export") == 0 ||
+			  strcmp(argv[0], "stats") == 0)) {
+		if (open_conf_file() < 0)
+			return 1;
+		rc = (argv[0][0] == 'e') ? export_conf_file(stdout) :
+			print_conf_stats(stdout);
+		close_conf_file();
+		return (rc < 0) ? 1 : 0;
 	}
 
-	if (init_driver_context() < 0) {
-		fprintf(stderr, "no driver is found\n");
+	if (script != NULL) {
+		if (argc > 0) {
+			usage(prog);
+			return 1;
+		}
+		/* don't let users read any files as root */
+		euid = geteuid();
+		if (seteuid(getuid()) < 0) {
+			fprintf(stderr, "seteuid: %s\n", strerror(errno));
+			return 1;
+		}
+		argc = read_script(script, buf, sizeof(buf), words,
+				   nitems(words));
+		if (seteuid(euid) < 0) {
+			fprintf(stderr, "seteuid: %s\n", strerror(errno));
+			return 1;
+		}
+		if (argc < 0)
+			return 1;
+		argv = words;
+	}
+
+	if (argc < 2 || parse_batch(argc, argv, &batch) < 0) {
+		usage(prog);
 		return 1;
 	}
 
-	if ((conf_fd = open(conf_filename, O_CREAT | O_RDWR, 0600)) < 0) {
-		fprintf(stderr, "can not open %s\n", conf_filename);
+	/* asmctld(8) controls the real devices */
+	if (! override) {
+		trace_begin(&tm, PHASE_REQUEST);
+		rc = client_request(opts, argc, argv);
+		trace_end(&tm);
+		if (rc >= 0)
+			return rc;
+	}
+
+	trace_begin(&tm, PHASE_OPEN);
+	rc = open_conf_file();
+	/* the cache file is optional */
+	if (rc == 0)
+		open_cache_file();
+	trace_end(&tm);
+	if (rc < 0)
 		goto err;
+
+	/* the leader of the key repeats applies my steps */
+	if ((leader = coalesce_batch(&batch)) == 0) {
+		/* the recorded AC power status, null if too old */
+		if (conf_get_recent_ac(ac_cache_msec, &ac_powered) < 0)
+			ac_powered = -1;
+		output_coalesced();
+		output_write(STDOUT_FILENO);
+		cleanup();
+		return 0;
 	}
 
-	/* lookup the driver context */
-	type = bsearch(argv[1], type_table, nitems(type_table),
-		      sizeof(type_table[0]), type_compare);
-	if (type == NULL) {
-		usage(argv[0]);
+	/* only the drivers of the commands */
+	trace_begin(&tm, PHASE_PROBE);
+	rc = init_batch_context(&batch);
+	trace_end(&tm);
+	if (rc < 0) {
+		fprintf(stderr, "no driver is found\n");
 		goto err;
 	}
-	ctx = type->context;
 
 #ifdef USE_CAPSICUM
-	if (init_capsicum(ctx) < 0)
+	trace_begin(&tm, PHASE_CAPSICUM);
+	rc = init_capsicum();
+	trace_end(&tm);
+	if (rc < 0)
 		goto err;
 #endif
 
 	/* initialize */
-	if (get_ac_powered() < 0 || get_saved_levels() < 0)
+	trace_begin(&tm, PHASE_AC);
+	rc = batch_ac_powered(&batch);
+	trace_end(&tm);
+	if (rc < 0)
 		goto err;
 
-	if (strcmp(argv[2], "acpi") == 0 || strcmp(argv[2], "a") == 0)
-		ASMC_ACPI(ctx);
-	else if (strcmp(argv[2], "up") == 0 || strcmp(argv[2], "u") == 0)
-		ASMC_UP(ctx);
-	else if (strcmp(argv[2], "down") == 0 || strcmp(argv[2], "d") == 0)
-		ASMC_DOWN(ctx);
-	else {
-		usage(argv[0]);
-		goto err;
+	if (leader > 0) {
+		/* the levels are loaded and stored by the leader */
+		trace_begin(&tm, PHASE_OPERATE);
+		rc = asmc_lead(batch.ab_ops[0].bo_cat);
+		trace_end(&tm);
+	} else {
+		/* no other process changes the levels until stored */
+		trace_begin(&tm, PHASE_LOAD);
+		rc = conf_lock(batch_categories(&batch));
+		if (rc == 0)
+			rc = get_saved_levels();
+		trace_end(&tm);
+		if (rc < 0)
+			goto err;
+
+		/* the devices are operated at the same time */
+		trace_begin(&tm, PHASE_OPERATE);
+		rc = asmc_operate_batch(&batch, 1);
+		trace_end(&tm);
+
+		/* the levels changed before a failure are stored */
+		trace_begin(&tm, PHASE_STORE);
+		store_conf_file();
+		conf_unlock(batch_categories(&batch));
+		trace_end(&tm);
 	}
-	store_conf_file();
 
+	/* all of the messages at once */
+	output_write(STDOUT_FILENO);
 	cleanup();
-	return 0;
+	return (rc < 0) ? 1 : 0;
 err:
 	cleanup();
 	return 1;
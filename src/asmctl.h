@@ -39,17 +39,43 @@
 #include <casper/cap_sysctl.h>
 #ifdef HAVE_CAPSICUM_HELPERS_H
 #include "capsicum_helpers.h"
-extern cap_channel_t *ch_sysctl;
 #else
 #include <nl_types.h>
 #endif
+extern cap_channel_t *ch_sysctl;
 #endif
 
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#ifdef HAVE_SYS_NV_H
 #include <sys/nv.h>
+#endif
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <sys/types.h>
+#include <time.h>
 
-#ifdef USE_CAPSICUM
-#define sysctlbyname(A, B, C, D, E)                                            \
-	cap_sysctlbyname(ch_sysctl, (A), (B), (C), (D), (E))
+#ifndef HAVE_SYS_NV_H
+/* the numbers of nvlist(9) are enough for the saved levels, see compat.c */
+#define NV_TYPE_NUMBER	2
+typedef struct nvlist nvlist_t;
+nvlist_t *nvlist_create(int);
+void nvlist_destroy(nvlist_t *);
+bool nvlist_exists_number(const nvlist_t *, const char *);
+uint64_t nvlist_get_number(const nvlist_t *, const char *);
+void nvlist_add_number(nvlist_t *, const char *, uint64_t);
+const char *nvlist_next(const nvlist_t *, int *, void **);
+#endif
+
+#ifndef HAVE_STRLCPY
+size_t strlcpy(char *, const char *, size_t);
+size_t strlcat(char *, const char *, size_t);
+#endif
+
+#ifndef nitems
+#define nitems(x) (sizeof((x)) / sizeof((x)[0]))
 #endif
 
 #define ARRAY_FOREACH(p, a) \
@@ -61,6 +87,130 @@ enum CATEGORY {
 	KEYBOARD
 };
 
+/* bits of the categories, such as for conf_lock() */
+#define CATEGORY_BIT(cat)  (1U << (cat))
+#define CATEGORY_ALL       (CATEGORY_BIT(VIDEO) | CATEGORY_BIT(KEYBOARD))
+
+enum OPERATION {
+	OP_NONE = 0,
+	OP_ACPI,
+	OP_UP,
+	OP_DOWN,
+	OP_SET,
+	OP_CALIBRATE
+};
+
+/* an operation with its argument */
+struct asmc_command {
+	enum OPERATION op;
+	int arg;
+	int percent;
+};
+
+/* operations given in one invocation */
+#define BATCH_MAXOPS     32
+#define BATCH_MAXARGS    (BATCH_MAXOPS * 3)
+#define BATCH_MAXSCRIPT  4096
+
+struct asmc_batch_op {
+	enum CATEGORY bo_cat;
+	int bo_unit;  /* -1 for all of the units */
+	struct asmc_command bo_cmd;
+};
+
+struct asmc_batch {
+	int ab_nops;
+	struct asmc_batch_op ab_ops[BATCH_MAXOPS];
+};
+
+/* statistics saved in the state file */
+enum STATISTIC {
+	STAT_HW_WRITES = 0,
+	STAT_HW_WRITES_SKIPPED,
+	STAT_STATE_WRITES,
+	STAT_STATE_WRITES_SKIPPED,
+	STAT_STEPS_COALESCED,
+	STAT_LIGHT_SAMPLES,
+	STAT_LIGHT_WRITES,
+	STAT_AC_EVENTS,
+	STAT_AC_SUPPRESSED,
+	STAT_AC_QUERIES,
+	STAT_AC_CACHED,
+	STAT_IDLE_INPUT_WAKEUPS,
+	STAT_IDLE_TIMER_WAKEUPS,
+	STAT_IDLE_DIMS
+};
+
+/* phases of the timing trace */
+enum PHASE {
+	PHASE_OTHER = 0,
+	PHASE_REQUEST,
+	PHASE_PROBE,
+	PHASE_OPEN,
+	PHASE_CAPSICUM,
+	PHASE_AC,
+	PHASE_LOAD,
+	PHASE_OPERATE,
+	PHASE_LEVELS,
+	PHASE_WRITE,
+	PHASE_STORE,
+	PHASE_MAX
+};
+
+struct trace_mark {
+	enum PHASE tm_prev;
+	struct timespec tm_start;
+};
+
+/* count a system call for the trace */
+#define TRACED(call)  (trace_syscall(), (call))
+
+/* local socket of asmctld(8) */
+#define ASMCTLD_SOCKET   "/var/run/asmctld.sock"
+#define ASMCTLD_MSGSIZE  4096
+#define ASMCTLD_MAXARGS  BATCH_MAXARGS
+#define ASMCTLD_OK       "OK"
+#define ASMCTLD_ERROR    "ERROR"
+/* clients waiting for the command, and the msec to wait */
+#define ASMCTLD_MAXCLIENTS  8
+#define ASMCTLD_TIMEOUT     1000
+/* msec to retry the levels locked by another process, and to give up */
+#define ASMCTLD_LOCK_RETRY    20
+#define ASMCTLD_LOCK_TIMEOUT  5000
+/* msec for asmctl(1) to wait for the reply */
+#define ASMCTLD_REPLY_TIMEOUT  10000
+/* words before the command to choose the output */
+#define ASMCTLD_JSON     "--json"
+#define ASMCTLD_QUIET    "-q"
+/* options sent with their arguments, see asmctl(1) */
+#define ASMCTLD_AC_CACHE  "-A"
+#define ASMCTLD_CURVE     "-C"
+#define ASMCTLD_FADE      "-F"
+
+/* output of an invocation, fits in a reply of asmctld(8) */
+enum OUTPUT {
+	OUTPUT_TEXT = 0,
+	OUTPUT_JSON,
+	OUTPUT_QUIET
+};
+
+#define OUTPUT_BUFSIZE     3584
+/* the object enclosing the devices in JSON */
+#define OUTPUT_JSON_EXTRA  64
+
+/* seqpacket socket of devd(8) */
+#define DEVD_SOCKET          "/var/run/devd.seqpacket.pipe"
+#define DEVD_MSGSIZE         1024
+#define DEVD_RETRY_INTERVAL  5000  /* msec */
+#define DEVD_SETTLE          500   /* msec */
+
+/* AC power status recorded in the state file is used in this time */
+#define AC_CACHE_MSEC  30000
+
+/* limits of the cache file */
+#define CACHE_MAXVALUES  128
+#define CACHE_FP_INIT    0xcbf29ce484222325ULL
+
 #ifdef HAVE_CAP_SYSCTL_LIMIT_NAME
 #define cap_sysctl_limit_destroy(l)
 #else
@@ -71,11 +221,77 @@ enum CATEGORY {
 #define cap_sysctl_limit_destroy(l)  nvlist_destroy((l))
 #endif
 
+/* table of the brightness levels */
+#define LEVEL_MAX        100
+#define LEVEL_MAXLEVELS  128
+
+struct level_table {
+	int lt_nlevels;
+	int lt_levels[LEVEL_MAXLEVELS];
+	unsigned char lt_ceil[LEVEL_MAX + 1];
+	unsigned char lt_nearest[LEVEL_MAX + 1];
+};
+
+/* perceptual curves of the steps */
+enum CURVE {
+	CURVE_LINEAR = 0,
+	CURVE_GAMMA,
+	CURVE_CIELAB
+};
+
+#define CURVE_GAMMA_EXP  2.2
+
+/* timer on the event loop of asmctld(8) */
+#define EVENT_MAXSOURCES  16
+
+struct event_timer {
+	struct timespec et_deadline;
+	void (*et_func)(void *);
+	void *et_arg;
+	int et_armed;
+	LIST_ENTRY(event_timer) et_link;
+};
+
+/* sampling of the ambient light sensors */
+#define LIGHT_MIN_INTERVAL  1000   /* msec */
+#define LIGHT_MAX_INTERVAL  16000  /* msec */
+
+/* idle dimming of the keyboard backlight */
+#define IDLE_SOURCE  "/dev/input/event0"
+#define IDLE_CHECKS  4  /* for more inputs in a timeout */
+#define IDLE_FADE    1000  /* msec to dim, unless -F is given */
+
+/* fade of the brightness */
+#define FADE_MIN_INTERVAL  10  /* msec */
+
+struct fade {
+	int (*fa_write)(void *, int);
+	void *fa_arg;
+	const struct level_table *fa_table;
+	int fa_from;
+	int fa_to;
+	int fa_level;
+	int fa_active;
+	long fa_duration;  /* fade_duration at the start */
+	long fa_interval;
+	struct timespec fa_start;
+	struct timespec fa_next;
+	struct event_timer fa_timer;
+};
+
+/* levels of a device, -1 if unknown */
+struct asmc_levels {
+	int al_current;
+	int al_economy;
+	int al_fullpower;
+};
+
 struct asmc_driver {
 	char *name;
 	enum CATEGORY category;
 	size_t ctx_size;
-	int (*init)(void *);
+	int (*probe)(int);  /* optional, check if the unit exists */
+	int (*init)(void *, int);
 	int (*load_conf)(void *, nvlist_t *);
 	int (*save_conf)(void *, nvlist_t *);
 #ifdef USE_CAPSICUM
@@ -83,31 +299,224 @@ struct asmc_driver {
 #endif
 	int (*cleanup)(void *);
 	int (*acpi_event)(void *);
-	int (*up)(void *);
-	int (*down)(void *);
+	int (*up)(void *, int);
+	int (*down)(void *, int);
+	int (*set)(void *, int, int);  /* the value and ASMC_SET_* */
+	int (*get_levels)(void *, struct asmc_levels *);
+	int (*read_level)(void *, int *);  /* from the hardware */
+	int (*calibrate)(void *);  /* optional */
+	int (*dim)(void *, int);  /* optional, the level is kept */
 };
 
+/* flags of set */
+#define ASMC_SET_PERCENT  0x01  /* percentage of the levels of the device */
+#define ASMC_SET_CURRENT  0x02  /* the saved levels for AC power are kept */
+#define ASMC_SET_FORCE    0x04  /* written even if it's the same level */
+
+/* devices of a category, such as the backlight(9) devices */
+#define ASMC_MAXUNITS   8
+#define ASMC_NCONTEXTS  (ASMC_MAXUNITS * 2)
+
 struct asmc_driver_context {
+	enum CATEGORY category;
+	int unit;
 	struct asmc_driver *driver;
 	void *context;
 };
 
-#define ASMC_INIT(c)  (c)->driver->init((c)->context)
+#define ASMC_INIT(c)  (c)->driver->init((c)->context, (c)->unit)
 #define ASMC_LOAD(c, v)  (c)->driver->load_conf((c)->context, (v))
 #define ASMC_SAVE(c, v)  (c)->driver->save_conf((c)->context, (v))
 #define ASMC_SET_RIGHTS(c, l)  \
 	(c)->driver->cap_set_rights((c)->context, (l))
 #define ASMC_CLEANUP(c)  (c)->driver->cleanup((c)->context)
 #define ASMC_ACPI(c)  (c)->driver->acpi_event((c)->context)
-#define ASMC_UP(c)  (c)->driver->up((c)->context)
-#define ASMC_DOWN(c)  (c)->driver->down((c)->context)
+#define ASMC_UP(c, n)  (c)->driver->up((c)->context, (n))
+#define ASMC_DOWN(c, n)  (c)->driver->down((c)->context, (n))
+#define ASMC_SET(c, v, p)  (c)->driver->set((c)->context, (v), (p))
+#define ASMC_LEVELS(c, l)  (c)->driver->get_levels((c)->context, (l))
+#define ASMC_READ(c, v)  (c)->driver->read_level((c)->context, (v))
+#define ASMC_CALIBRATE(c)  (c)->driver->calibrate((c)->context)
+#define ASMC_DIM(c, d)  (c)->driver->dim((c)->context, (d))
+
+/* access to the hardware, replaced by the fake one in the benchmark */
+struct asmc_hw {
+	char *name;
+	int (*sysctl)(const char *, void *, size_t *, const void *, size_t);
+	int (*open)(const char *, int);
+	int (*close)(int);
+	int (*ioctl)(int, unsigned long, void *);
+	ssize_t (*pread)(int, void *, size_t, off_t);
+	ssize_t (*pwrite)(int, const void *, size_t, off_t);
+};
+
+#define HW_SYSCTL(n, o, ol, v, vl)  \
+	TRACED(asmc_hw->sysctl((n), (o), (ol), (v), (vl)))
+#define HW_OPEN(p, f)  TRACED(asmc_hw->open((p), (f)))
+#define HW_CLOSE(d)  TRACED(asmc_hw->close((d)))
+#define HW_IOCTL(d, r, a)  TRACED(asmc_hw->ioctl((d), (r), (a)))
+#define HW_PREAD(d, b, l, o)  \
+	TRACED(asmc_hw->pread((d), (b), (l), (o)))
+#define HW_PWRITE(d, b, l, o)  \
+	TRACED(asmc_hw->pwrite((d), (b), (l), (o)))
 
 int conf_get_int(nvlist_t *, const char *, int *);
+void conf_set_int(int *, int);
+void conf_set_int64(int64_t *, int64_t);
+void conf_count(enum STATISTIC, int);
 int choose_acpi_level(int, int);
 
+int init_driver_context(void);
+int open_conf_file(void);
+void close_conf_file(void);
+int get_saved_levels(void);
+int store_conf_file(void);
+int export_conf_file(FILE *);
+uint64_t conf_stat(enum STATISTIC);
+int conf_get_status(enum CATEGORY, int, int *, struct asmc_levels *);
+int conf_get_ac(void);
+void conf_set_ac(int);
+int conf_get_recent_ac(long, int *);
+int print_conf_stats(FILE *);
+void conf_pending_add(enum CATEGORY, int);
+int conf_pending_take(enum CATEGORY);
+int conf_pending_get(enum CATEGORY);
+int conf_lead(enum CATEGORY);
+void conf_unlead(enum CATEGORY);
+int conf_lock(unsigned);
+int conf_trylock(unsigned);
+void conf_unlock(unsigned);
+int get_ac_powered(void);
+int batch_ac_powered(const struct asmc_batch *);
+#ifdef __linux__
+int sysfs_get_ac_powered(int *);
+#endif
+#ifdef USE_CAPSICUM
+int init_capsicum(void);
+void hw_sysctl_limit(cap_sysctl_limit_t *, const char *, int);
+#endif
+void cleanup(void);
+
+int open_cache_file(void);
+void close_cache_file(void);
+int cache_get(const char *, uint64_t, int *, int);
+int cache_put(const char *, uint64_t, const int *, int);
+uint64_t cache_fingerprint(uint64_t, const void *, size_t);
+struct asmc_driver_context *asmc_context(enum CATEGORY, int);
+int init_units(enum CATEGORY, int);
+int lookup_category(const char *, enum CATEGORY *, int *);
+int parse_command(int, char **, struct asmc_command *);
+int parse_msec(const char *, long *);
+int asmc_operate(struct asmc_driver_context *, const struct asmc_command *);
+int parse_batch(int, char **, struct asmc_batch *);
+int init_batch_context(const struct asmc_batch *);
+unsigned batch_categories(const struct asmc_batch *);
+int asmc_operate_batch(const struct asmc_batch *, int);
+int read_script(const char *, char *, size_t, char **, int);
+int coalesce_batch(const struct asmc_batch *);
+int asmc_lead(enum CATEGORY);
+const char *asmc_category_name(enum CATEGORY);
+int asmc_driver_index(const struct asmc_driver *);
+int asmc_status(enum CATEGORY, int, int);
+
+int level_table_init(struct level_table *, const int *, int);
+int level_table_generate(struct level_table *, int);
+int level_index(const struct level_table *, int);
+int level_nearest(const struct level_table *, int);
+int level_percent(const struct level_table *, int);
+int level_step(const struct level_table *, int, int);
+int parse_curve(const char *);
+
+void output_text(const char *, ...);
+void output_levels(const struct asmc_driver_context *,
+		   const struct asmc_levels *, const struct asmc_levels *);
+void output_status(enum CATEGORY, int, const char *,
+		   const struct asmc_levels *, int);
+void output_coalesced(void);
+size_t output_get(char *, size_t);
+int output_write(int);
+const struct level_table *level_curve(int);
+int level_curve_step(const struct level_table *, int, int, int);
+
+void timespec_add_msec(struct timespec *, long);
+long timespec_diff_msec(const struct timespec *, const struct timespec *);
+int event_add(int, void (*)(int, void *), void *);
+void event_remove(int);
+void event_timer_init(struct event_timer *, void (*)(void *), void *);
+void event_timer_set(struct event_timer *, long);
+void event_timer_set_abs(struct event_timer *, const struct timespec *);
+void event_timer_stop(struct event_timer *);
+int event_loop(const sigset_t *, volatile sig_atomic_t *);
+
+void trace_init(void);
+void trace_begin(struct trace_mark *, enum PHASE);
+void trace_end(struct trace_mark *);
+void trace_syscall(void);
+void trace_print(FILE *);
+
+int devd_open(const char *);
+int devd_parse(char *, int *);
+int devd_handle(char *);
+int devd_settle(void);
+int devd_ac_event(int);
+int devd_listen(void);
+
+long light_sample(void);
+int light_start(void);
+#ifdef USE_CAPSICUM
+void light_cap_set_rights(cap_sysctl_limit_t *);
+#endif
+
+long idle_reset(long);
+long idle_input(long);
+long idle_expire(long, int);
+int idle_watching(void);
+int idle_is_dimmed(void);
+void idle_wake(void);
+int idle_start(void);
+void idle_stop(void);
+
+int hw_fake_init(long, int);
+int hw_fake_get(const char *, int *);
+int hw_fake_set(const char *, int);
+void hw_fake_panel(int);
+int hw_fake_brightness(int, int *);
+
+void fade_init(struct fade *, int (*)(void *, int), void *);
+void fade_set_levels(struct fade *, const struct level_table *);
+int fade_to(struct fade *, int, int);
+int fade_is_active(const struct fade *);
+
+extern int trace_enabled;
+extern enum OUTPUT output_mode;
+extern enum CURVE curve_type;
+extern int curve_steps;
+extern int fade_duration;
+extern int fade_async;
+
+extern struct asmc_hw *asmc_hw;
+extern struct asmc_hw hw_real, hw_fake;
+extern _Atomic unsigned long hw_fake_calls;
+
 extern struct asmc_driver acpi_video_driver;
 extern struct asmc_driver acpi_keyboard_driver;
 extern struct asmc_driver backlight_driver;
+extern struct asmc_driver sysfs_backlight_driver;
+extern struct asmc_driver sysfs_kbd_driver;
+extern char *sysfs_root;
+extern char *devd_socket;
+extern long devd_settle_msec;
+extern int light_enabled;
+extern char *idle_source;
+extern long idle_timeout_msec;
+extern long idle_fade_msec;
 extern int ac_powered;
+extern long ac_cache_msec;
+extern char *conf_filename;
+extern int conf_fd;
+extern char *cache_filename;
+extern int cache_fd;
+extern char *backlight_dir;
+extern struct asmc_driver_context asmc_contexts[ASMC_NCONTEXTS];
 
 #endif
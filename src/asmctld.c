@@ -0,0 +1,610 @@
+/*-
+ * Copyright (c) 2026 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Resident daemon for asmctl(1).
+ *
+ * asmctld keeps the driver contexts, the opened devices and the saved
+ * levels in memory, and serves the asmctl(1) commands sent to the local
+ * socket. It saves the keypress from initializing the drivers, the
+ * capsicum(4) sandbox and parsing the state file every time.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "asmctl.h"
+
+/* path of the local socket and the group allowed to connect */
+static char *socket_path = ASMCTLD_SOCKET;
+static char *socket_group = NULL;
+
+static void on_client_timeout(void *);
+static void on_lock_retry(void *);
+
+/*
+  The clients that have not been replied yet. The command is kept while
+  another process holds the levels, 'cl_len' is -1 until it comes.
+ */
+struct client {
+	int cl_fd;
+	struct timespec cl_deadline;
+	ssize_t cl_len;
+	char cl_buf[ASMCTLD_MSGSIZE];
+};
+
+static struct client clients[ASMCTLD_MAXCLIENTS];
+static int nclients = 0;
+static struct event_timer client_timer = {.et_func = on_client_timeout};
+static struct event_timer lock_timer = {.et_func = on_lock_retry};
+
+/* set by the signal handler to exit the main loop */
+static volatile sig_atomic_t terminated = 0;
+
+static void
+on_signal(int sig)
+{
+	terminated = 1;
+}
+
+static int
+open_socket(const char *path, const char *group)
+{
+	struct sockaddr_un sun;
+	struct group *gr = NULL;
+	mode_t mode = 0666;
+	int s;
+
+	if (group != NULL) {
+		if ((gr = getgrnam(group)) == NULL) {
+			fprintf(stderr, "unknown group: %s\n", group);
+			return -1;
+		}
+		mode = 0660;
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_LOCAL;
+	if (strlcpy(sun.sun_path, path, sizeof(sun.sun_path)) >=
+	    sizeof(sun.sun_path)) {
+		fprintf(stderr, "too long socket path: %s\n", path);
+		return -1;
+	}
+
+	if ((s = socket(PF_LOCAL, SOCK_SEQPACKET, 0)) < 0) {
+		fprintf(stderr, "socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	/* remove the stale socket left by the previous process */
+	unlink(path);
+
+	if (bind(s, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+		fprintf(stderr, "bind %s: %s\n", path, strerror(errno));
+		goto err;
+	}
+
+	/*
+	  Any user can control backlights as well as setuid asmctl(1),
+	  unless the group is given.
+	 */
+	if (gr != NULL && chown(path, -1, gr->gr_gid) < 0) {
+		fprintf(stderr, "chown %s: %s\n", path, strerror(errno));
+		goto err;
+	}
+	if (chmod(path, mode) < 0) {
+		fprintf(stderr, "chmod %s: %s\n", path, strerror(errno));
+		goto err;
+	}
+
+	if (listen(s, SOMAXCONN) < 0) {
+		fprintf(stderr, "listen: %s\n", strerror(errno));
+		goto err;
+	}
+
+	return s;
+err:
+	close(s);
+	return -1;
+}
+
+/* 'all acpi' run by the devd(8) rule on every notification */
+static int
+is_all_acpi(const struct asmc_batch *b)
+{
+	int i, cats = 0;
+
+	for (i = 0; i < b->ab_nops; i++) {
+		if (b->ab_ops[i].bo_cmd.op != OP_ACPI ||
+		    b->ab_ops[i].bo_unit >= 0)
+			return 0;
+		cats |= 1 << b->ab_ops[i].bo_cat;
+	}
+	return cats == (1 << VIDEO | 1 << KEYBOARD);
+}
+
+/*
+  Execute one command and returns the reply message, or NULL if another
+  process holds the levels.
+ */
+static const char *
+execute(int argc, char *argv[])
+{
+	struct asmc_batch batch;
+	int rc;
+
+	if (argc < 2 || parse_batch(argc, argv, &batch) < 0)
+		return ASMCTLD_ERROR " invalid command";
+
+	/* the status recorded on the last event, unless it's too old */
+	if (batch_ac_powered(&batch) < 0)
+		return ASMCTLD_ERROR " can not get AC power status";
+
+	/* settled as the notifications of the devd(8) listener */
+	if (is_all_acpi(&batch)) {
+		devd_ac_event(ac_powered);
+		return ASMCTLD_OK;
+	}
+
+	/*
+	  asmctl(1) with -D or -S may change the levels as well, the event
+	  loop doesn't wait for it.
+	 */
+	if ((rc = conf_trylock(batch_categories(&batch))) == 0)
+		return NULL;
+	if (rc < 0 || get_saved_levels() < 0) {
+		conf_unlock(batch_categories(&batch));
+		return ASMCTLD_ERROR " can not load the levels";
+	}
+
+	/* the keyboard dimmed while idle is lit to be changed */
+	idle_wake();
+
+	/* the fades run on the event loop at the same time */
+	rc = asmc_operate_batch(&batch, 0);
+	store_conf_file();
+	conf_unlock(batch_categories(&batch));
+
+	return (rc < 0) ? ASMCTLD_ERROR " failed to set brightness" :
+		ASMCTLD_OK;
+}
+
+/*
+  Reply to the command received from the client. Returns 0 if replied,
+  1 if it's to be retried as another process holds the levels.
+ */
+static int
+handle_client(struct client *cl)
+{
+	char buf[ASMCTLD_MSGSIZE], out[ASMCTLD_MSGSIZE];
+	char *args[ASMCTLD_MAXARGS], *p, *q;
+	const char *reply;
+	ssize_t len;
+	long ac_msec, msec;
+	enum CURVE type;
+	int i, n = 0, fade_msec, steps;
+
+	/* the command is split in the copy to be retried */
+	memcpy(buf, cl->cl_buf, cl->cl_len);
+	buf[cl->cl_len] = '\0';
+
+	p = buf;
+	while ((q = strsep(&p, " \t\n")) != NULL) {
+		if (*q == '\0')
+			continue;
+		if (n == nitems(args))
+			break;
+		args[n++] = q;
+	}
+
+	/* the options of asmctl(1) precede the command */
+	output_mode = OUTPUT_TEXT;
+	ac_msec = ac_cache_msec;
+	fade_msec = fade_duration;
+	type = curve_type;
+	steps = curve_steps;
+	reply = NULL;
+	for (i = 0; i < n && args[i][0] == '-' && reply == NULL; i++) {
+		if (strcmp(args[i], ASMCTLD_JSON) == 0)
+			output_mode = OUTPUT_JSON;
+		else if (strcmp(args[i], ASMCTLD_QUIET) == 0)
+			output_mode = OUTPUT_QUIET;
+		else if (i + 1 == n)
+			reply = ASMCTLD_ERROR " invalid option";
+		else if (strcmp(args[i], ASMCTLD_AC_CACHE) == 0) {
+			if (parse_msec(args[++i], &ac_cache_msec) < 0)
+				reply = ASMCTLD_ERROR " invalid option";
+		} else if (strcmp(args[i], ASMCTLD_FADE) == 0) {
+			if (parse_msec(args[++i], &msec) < 0)
+				reply = ASMCTLD_ERROR " invalid option";
+			else
+				fade_duration = msec;
+		} else if (strcmp(args[i], ASMCTLD_CURVE) == 0) {
+			if (parse_curve(args[++i]) < 0)
+				reply = ASMCTLD_ERROR " invalid option";
+		} else
+			reply = ASMCTLD_ERROR " invalid option";
+	}
+	if (reply == NULL)
+		reply = execute(n - i, &args[i]);
+
+	/* the options last for the command only */
+	ac_cache_msec = ac_msec;
+	fade_duration = fade_msec;
+	curve_type = type;
+	curve_steps = steps;
+
+	/* the output of the attempt is discarded */
+	if (reply == NULL) {
+		output_get(out, sizeof(out));
+		output_mode = OUTPUT_QUIET;
+		return 1;
+	}
+
+	/* the output follows the first line of the reply */
+	if (strcmp(reply, ASMCTLD_OK) == 0) {
+		len = snprintf(out, sizeof(out), "%s\n", ASMCTLD_OK);
+		output_get(&out[len], sizeof(out) - len);
+		reply = out;
+	} else
+		output_get(out, sizeof(out));
+	output_mode = OUTPUT_QUIET;
+
+	send(cl->cl_fd, reply, strlen(reply), 0);
+	return 0;
+}
+
+/* the timer expires at the nearest deadline of the clients */
+static void
+set_client_timer(void)
+{
+	struct timespec *deadline = NULL;
+	int i;
+
+	for (i = 0; i < nclients; i++)
+		if (deadline == NULL ||
+		    timespec_diff_msec(&clients[i].cl_deadline, deadline) < 0)
+			deadline = &clients[i].cl_deadline;
+
+	if (deadline == NULL)
+		event_timer_stop(&client_timer);
+	else
+		event_timer_set_abs(&client_timer, deadline);
+}
+
+static void
+close_client(int i)
+{
+	event_remove(clients[i].cl_fd);
+	close(clients[i].cl_fd);
+	clients[i] = clients[--nclients];
+}
+
+/*
+  Reply to the commands in the order received, they are retried later
+  from the first one waiting for the levels.
+ */
+static void
+serve_clients(void)
+{
+	int i, first;
+
+	event_timer_stop(&lock_timer);
+	for (;;) {
+		first = -1;
+		for (i = 0; i < nclients; i++)
+			if (clients[i].cl_len >= 0 &&
+			    (first < 0 ||
+			     timespec_diff_msec(&clients[i].cl_deadline,
+						&clients[first].cl_deadline) < 0))
+				first = i;
+		if (first < 0)
+			break;
+		if (handle_client(&clients[first]) != 0) {
+			event_timer_set(&lock_timer, ASMCTLD_LOCK_RETRY);
+			break;
+		}
+		close_client(first);
+	}
+	set_client_timer();
+}
+
+/* called by the event loop when a client sends the command */
+static void
+on_client(int c, void *arg)
+{
+	struct client *cl = NULL;
+	int i;
+
+	for (i = 0; i < nclients; i++)
+		if (clients[i].cl_fd == c) {
+			cl = &clients[i];
+			break;
+		}
+	if (cl == NULL)
+		return;
+
+	/* the socket doesn't block */
+	if ((cl->cl_len = recv(c, cl->cl_buf, sizeof(cl->cl_buf) - 1,
+			       0)) <= 0) {
+		close_client(i);
+		set_client_timer();
+		return;
+	}
+
+	/* nothing more is read while the command waits for the levels */
+	event_remove(c);
+	clock_gettime(CLOCK_MONOTONIC, &cl->cl_deadline);
+	timespec_add_msec(&cl->cl_deadline, ASMCTLD_LOCK_TIMEOUT);
+	serve_clients();
+}
+
+static void
+on_lock_retry(void *arg)
+{
+	serve_clients();
+}
+
+/*
+  Close the clients that send nothing not to be held by them, and the
+  ones whose levels are held by another process for too long.
+ */
+static void
+on_client_timeout(void *arg)
+{
+	static const char reply[] = ASMCTLD_ERROR " the levels are locked";
+	struct timespec now;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = nclients - 1; i >= 0; i--)
+		if (timespec_diff_msec(&clients[i].cl_deadline, &now) <= 0) {
+			if (clients[i].cl_len >= 0)
+				send(clients[i].cl_fd, reply,
+				     sizeof(reply) - 1, 0);
+			close_client(i);
+		}
+	set_client_timer();
+}
+
+/*
+  Called by the event loop when a client connects. The command is
+  received when it comes, and the oldest client is closed if too many
+  clients are waiting.
+ */
+static void
+on_accept(int s, void *arg)
+{
+	struct client *cl;
+	int c, i, oldest = 0;
+
+	if ((c = accept(s, NULL, NULL)) < 0) {
+		if (errno != EINTR && errno != ECONNABORTED)
+			fprintf(stderr, "accept: %s\n", strerror(errno));
+		return;
+	}
+
+	if (fcntl(c, F_SETFL, O_NONBLOCK) < 0) {
+		fprintf(stderr, "fcntl: %s\n", strerror(errno));
+		close(c);
+		return;
+	}
+
+	if (nclients == nitems(clients)) {
+		for (i = 1; i < nclients; i++)
+			if (timespec_diff_msec(&clients[i].cl_deadline,
+					       &clients[oldest].cl_deadline) < 0)
+				oldest = i;
+		close_client(oldest);
+	}
+
+	if (event_add(c, on_client, NULL) < 0) {
+		close(c);
+		return;
+	}
+	cl = &clients[nclients++];
+	cl->cl_fd = c;
+	cl->cl_len = -1;
+	clock_gettime(CLOCK_MONOTONIC, &cl->cl_deadline);
+	timespec_add_msec(&cl->cl_deadline, ASMCTLD_TIMEOUT);
+	set_client_timer();
+}
+
+static void
+usage(const char *prog)
+{
+	printf("usage: %s [-afl] [-A msec] [-C curve[:steps]] [-D dir] "
+	       "[-d devd_socket] [-F msec] [-g group] [-I source] [-i msec] "
+	       "[-S sysfs] [-s socket] [-w msec]\n", prog);
+	printf("\nServe asmctl commands on the local socket.\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	int ch, s, rc, foreground = 0, listen_devd = 0;
+	long msec;
+	struct sigaction sa;
+	sigset_t mask, omask;
+
+	while ((ch = getopt(argc, argv, "A:aC:D:d:fF:g:I:i:lS:s:w:")) != -1) {
+		switch (ch) {
+		case 'A':
+			if (parse_msec(optarg, &ac_cache_msec) < 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'a':
+			listen_devd = 1;
+			break;
+		case 'C':
+			if (parse_curve(optarg) < 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'D':
+			backlight_dir = optarg;
+			break;
+		case 'd':
+			devd_socket = optarg;
+			break;
+		case 'f':
+			foreground = 1;
+			break;
+		case 'F':
+			if (parse_msec(optarg, &msec) < 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			fade_duration = msec;
+			break;
+		case 'g':
+			socket_group = optarg;
+			break;
+		case 'I':
+			idle_source = optarg;
+			break;
+		case 'i':
+			if (parse_msec(optarg, &idle_timeout_msec) < 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'l':
+			light_enabled = 1;
+			break;
+		case 'S':
+			sysfs_root = optarg;
+			break;
+		case 's':
+			socket_path = optarg;
+			break;
+		case 'w':
+			if (parse_msec(optarg, &devd_settle_msec) < 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (open_conf_file() < 0)
+		return 1;
+
+	/* the events of devd(8) and the light sensors are not printed */
+	output_mode = OUTPUT_QUIET;
+
+	/* the cache file is optional */
+	open_cache_file();
+
+	/* both drivers are needed before entering capability mode */
+	if (init_driver_context() < 0) {
+		fprintf(stderr, "no driver is found\n");
+		goto err;
+	}
+
+	if ((s = open_socket(socket_path, socket_group)) < 0)
+		goto err;
+
+	if (! foreground && daemon(0, 0) < 0) {
+		fprintf(stderr, "daemon: %s\n", strerror(errno));
+		goto err;
+	}
+
+	/* the signals are delivered only while waiting for events */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGHUP);
+	sigprocmask(SIG_BLOCK, &mask, &omask);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	/* AC power notifications are applied without asmctl(1) */
+	if (listen_devd && devd_listen() < 0)
+		goto err;
+
+	/* the backlights follow the ambient light */
+	if (light_enabled && light_start() < 0)
+		goto err;
+
+	/* the keyboard backlight is dimmed while no input comes */
+	if (idle_timeout_msec > 0 && idle_start() < 0)
+		goto err;
+
+#ifdef USE_CAPSICUM
+	if (init_capsicum() < 0)
+		goto err;
+#endif
+
+	if (get_saved_levels() < 0)
+		goto err;
+
+	/* fades run on the event loop */
+	fade_async = 1;
+
+	if (event_add(s, on_accept, NULL) < 0)
+		goto err;
+	rc = event_loop(&omask, &terminated);
+
+	/* the keyboard is lit again without the event loop */
+	fade_async = 0;
+	idle_stop();
+
+	/*
+	  The socket file is left in capability mode, asmctl(1) falls back
+	  to control devices by itself and the next asmctld removes it.
+	 */
+	close(s);
+	cleanup();
+	return (rc < 0) ? 1 : 0;
+err:
+	cleanup();
+	return 1;
+}
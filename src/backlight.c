@@ -26,86 +26,285 @@
  *
  */
 
+#include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/backlight.h>
 #include <sys/ioctl.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 
 #include "asmctl.h"
 
-#define BACKLIGHT_ECO_LEVEL "backlight_economy_level"
-#define BACKLIGHT_FUL_LEVEL "backlight_full_level"
-#define BACKLIGHT_CUR_LEVEL "backlight_current_level"
+#define BACKLIGHT_PREFIX "backlight"
 
-/* file name of default backlight device */
-static char *backlight_device = "/dev/backlight/backlight0";
+/* the names of backlight0 are kept for the older state file */
+#define BACKLIGHT_ECO_LEVEL "economy_level"
+#define BACKLIGHT_FUL_LEVEL "full_level"
+#define BACKLIGHT_CUR_LEVEL "current_level"
+
+#define BACKLIGHT_NAMELEN 24
+#define BACKLIGHT_KEYLEN  48
+
+/* steps of a curve over the generated levels */
+#define BACKLIGHT_NSTEPS  20
+
+/*
+  The calibration has the brightness that the panel rounds down on
+  each level written, 2 bits of each level in the numbers of the state
+  file named 'backlight<N>_calibration<M>'.
+ */
+#define BACKLIGHT_CALIBRATION  "calibration"
+#define CALIBRATION_BITS       2
+#define CALIBRATION_MAXDROP    ((1 << CALIBRATION_BITS) - 1)
+#define CALIBRATION_PER_WORD   (64 / CALIBRATION_BITS)
+#define CALIBRATION_NWORDS \
+	((LEVEL_MAX + CALIBRATION_PER_WORD) / CALIBRATION_PER_WORD)
+
+/* numbers of the devices in the directory, sorted */
+static int backlight_units[ASMC_MAXUNITS];
+static int backlight_nunits = -1;
 
 struct backlight_context {
+	char bc_name[BACKLIGHT_NAMELEN];
+	char bc_eco_key[BACKLIGHT_KEYLEN];
+	char bc_ful_key[BACKLIGHT_KEYLEN];
+	char bc_cur_key[BACKLIGHT_KEYLEN];
 	int bc_economy_level;
 	int bc_fullpower_level;
 	int bc_current_level;
 	int bc_fd;
+	uint64_t bc_fingerprint;
 	bool bc_levels_are_generated;
-	int bc_nlevels;
-	int *bc_levels;
+	int bc_calibrated;
+	int64_t bc_calibration[CALIBRATION_NWORDS];
+	/* the level written for each visible level if calibrated */
+	unsigned char bc_write[LEVEL_MAX + 1];
+	struct level_table bc_table;
+	struct fade bc_fade;
 };
 
+static int write_backlight_video_level(void *, int);
+
 static int
-get_backlight_video_levels(struct backlight_context *c) {
-	int i;
+compare_video_levels(const void *a, const void *b)
+{
+	return (*(int*)a - *(int*)b);
+}
+
+/*
+  Find the devices named 'backlight<N>' in the directory, the others
+  are the aliases of them named by the drivers. It's done only once.
+ */
+static int
+enumerate_backlights(void)
+{
+	DIR *d;
+	struct dirent *e;
+	const char *p;
+	char *q;
+	long n;
+
+	if (backlight_nunits >= 0)
+		return backlight_nunits;
+
+	backlight_nunits = 0;
+	if ((d = opendir(backlight_dir)) == NULL)
+		return 0;
+
+	while ((e = readdir(d)) != NULL &&
+	       backlight_nunits < nitems(backlight_units)) {
+		if (strncmp(e->d_name, BACKLIGHT_PREFIX,
+			    strlen(BACKLIGHT_PREFIX)) != 0)
+			continue;
+		p = &e->d_name[strlen(BACKLIGHT_PREFIX)];
+		if (! isdigit((unsigned char)*p) ||
+		    (n = strtol(p, &q, 10)) > INT_MAX || *q != '\0')
+			continue;
+		backlight_units[backlight_nunits++] = n;
+	}
+	closedir(d);
+
+	qsort(backlight_units, backlight_nunits, sizeof(int),
+	      compare_video_levels);
+	return backlight_nunits;
+}
+
+/*
+  Retrieve the levels by BACKLIGHTGETSTATUS. The first element of the
+  'levels' is set 1 if the levels are generated.
+  Returns the number of elements.
+ */
+static int
+fetch_backlight_video_levels(struct backlight_context *c, int *levels)
+{
+	int i, n;
 	/* struct containing backlight(9) properties */
 	struct backlight_props props;
 
-	if (c->bc_fd < 0)
-		return -1;
-
-	if (ioctl(c->bc_fd, BACKLIGHTGETSTATUS, &props) < 0) {
+	if (HW_IOCTL(c->bc_fd, BACKLIGHTGETSTATUS, &props) < 0) {
 		fprintf(stderr, "ioctl BACKLIGHTGETSTATUS : %s\n",
 			strerror(errno));
 		return -1;
 	}
 
-	c->bc_nlevels = (props.nlevels != 0) ?
-		props.nlevels : BACKLIGHTMAXLEVELS + 1;
-	c->bc_levels_are_generated = (props.nlevels == 0);
+	n = (props.nlevels != 0) ? props.nlevels : BACKLIGHTMAXLEVELS + 1;
+	levels[0] = (props.nlevels == 0);
+	for (i = 0; i < n; i++)
+		levels[i + 1] = (props.nlevels != 0) ? props.levels[i] : i;
+	qsort(&levels[1], n, sizeof(int), compare_video_levels);
 
-	c->bc_levels = malloc(c->bc_nlevels * sizeof(int));
-	if (c->bc_levels == NULL) {
-		fprintf(stderr, "failed to allocate %zu bytes memory\n",
-			c->bc_nlevels * sizeof(int));
-		return -1;
+	if (c->bc_current_level < 0)
+		conf_set_int(&c->bc_current_level, props.brightness);
+
+	return n + 1;
+}
+
+/*
+  Read the levels that the device accepts from the cache file, or
+  retrieve them. Returns the number of elements as
+  fetch_backlight_video_levels().
+ */
+static int
+read_backlight_video_levels(struct backlight_context *c, int *buf, int size)
+{
+	int n;
+	struct trace_mark tm;
+
+	/* the current brightness is needed if it's not saved */
+	n = (c->bc_current_level < 0) ? -1 :
+		cache_get(c->bc_name, c->bc_fingerprint, buf, size);
+	if (n < 2) {
+		trace_begin(&tm, PHASE_LEVELS);
+		n = fetch_backlight_video_levels(c, buf);
+		trace_end(&tm);
+		if (n < 0)
+			return -1;
+		cache_put(c->bc_name, c->bc_fingerprint, buf, n);
 	}
 
-	for (i = 0; i < c->bc_nlevels; i++)
-		c->bc_levels[i] = (props.nlevels != 0) ? props.levels[i] : i;
+	return n;
+}
+
+static int
+calibration_drop(const struct backlight_context *c, int level)
+{
+	return (c->bc_calibration[level / CALIBRATION_PER_WORD] >>
+		(level % CALIBRATION_PER_WORD * CALIBRATION_BITS)) &
+		CALIBRATION_MAXDROP;
+}
+
+/*
+  Make the table of the visible levels from the levels that the device
+  accepts. The first level written is used for each visible level.
+ */
+static int
+init_calibrated_table(struct backlight_context *c, const int *levels, int n)
+{
+	int i, v, nvisible = 0, visible[LEVEL_MAX + 1];
+	bool seen[LEVEL_MAX + 1];
+
+	memset(seen, 0, sizeof(seen));
+	for (i = 0; i < n; i++) {
+		v = MAX(0, levels[i] - calibration_drop(c, levels[i]));
+		if (! seen[v]) {
+			seen[v] = true;
+			c->bc_write[v] = levels[i];
+		}
+	}
+	for (v = 0; v <= LEVEL_MAX; v++)
+		if (seen[v])
+			visible[nvisible++] = v;
+
+	return level_table_init(&c->bc_table, visible, nvisible);
+}
+
+static int
+get_backlight_video_levels(struct backlight_context *c) {
+	int n, buf[CACHE_MAXVALUES];
+
+	if (c->bc_fd < 0)
+		return -1;
+
+	/* already retrieved, asmctld(8) keeps them in memory. */
+	if (c->bc_table.lt_nlevels > 0)
+		return 0;
+
+	if ((n = read_backlight_video_levels(c, buf, nitems(buf))) < 0)
+		return -1;
+
+	c->bc_levels_are_generated = buf[0];
+	if ((c->bc_calibrated ?
+	     init_calibrated_table(c, &buf[1], n - 1) :
+	     level_table_init(&c->bc_table, &buf[1], n - 1)) < 0)
+		return -1;
 
-	if (c->bc_current_level < 0)
-		c->bc_current_level = props.brightness;
 	if (c->bc_economy_level < 0)
-		c->bc_economy_level = 60; // arbitrary value
+		conf_set_int(&c->bc_economy_level, 60); // arbitrary value
 	if (c->bc_fullpower_level < 0)
-		c->bc_fullpower_level = 100; // arbitrary value
+		conf_set_int(&c->bc_fullpower_level, 100); // arbitrary value
 
 	return 0;
 }
 
+/* set the names of the device and its levels in the state file */
+static void
+set_backlight_names(struct backlight_context *c, int n)
+{
+	const char *prefix = BACKLIGHT_PREFIX;
+
+	snprintf(c->bc_name, sizeof(c->bc_name), "%s%d", BACKLIGHT_PREFIX,
+		 n);
+	if (n > 0)
+		prefix = c->bc_name;
+
+	snprintf(c->bc_eco_key, sizeof(c->bc_eco_key), "%s_%s", prefix,
+		 BACKLIGHT_ECO_LEVEL);
+	snprintf(c->bc_ful_key, sizeof(c->bc_ful_key), "%s_%s", prefix,
+		 BACKLIGHT_FUL_LEVEL);
+	snprintf(c->bc_cur_key, sizeof(c->bc_cur_key), "%s_%s", prefix,
+		 BACKLIGHT_CUR_LEVEL);
+}
+
 static int
-backlight_init(void *context)
+backlight_init(void *context, int unit)
 {
-	int fd;
 	struct backlight_context *c = context;
+	char path[PATH_MAX];
+	struct stat st;
+
+	c->bc_fd = -1;
+	if (unit >= enumerate_backlights())
+		return -1;
+
+	set_backlight_names(c, backlight_units[unit]);
+	snprintf(path, sizeof(path), "%s/%s", backlight_dir, c->bc_name);
 
 	/* may fail */
-	if ((c->bc_fd = open(backlight_device, O_RDWR)) < 0)
+	if ((c->bc_fd = HW_OPEN(path, O_RDWR)) < 0)
 		return -1;
 
+	/* a new device node is created when the driver is attached again */
+	if (fstat(c->bc_fd, &st) < 0) {
+		HW_CLOSE(c->bc_fd);
+		c->bc_fd = -1;
+		return -1;
+	}
+	c->bc_fingerprint = cache_fingerprint(CACHE_FP_INIT, &st.st_rdev,
+					      sizeof(st.st_rdev));
+	c->bc_fingerprint = cache_fingerprint(c->bc_fingerprint, &st.st_ino,
+					      sizeof(st.st_ino));
+
 	c->bc_economy_level = -1;
 	c->bc_fullpower_level = -1;
 	c->bc_current_level = -1;
+	c->bc_calibrated = 0;
+	fade_init(&c->bc_fade, write_backlight_video_level, c);
 
 	return 0;
 }
@@ -115,9 +314,27 @@ backlight_load_conf(void *context, nvlist_t *cf)
 {
 	struct backlight_context *c = context;
 
-	if (conf_get_int(cf, BACKLIGHT_ECO_LEVEL, &c->bc_economy_level) < 0 ||
-	    conf_get_int(cf, BACKLIGHT_FUL_LEVEL, &c->bc_fullpower_level) < 0 ||
-	    conf_get_int(cf, BACKLIGHT_CUR_LEVEL, &c->bc_current_level) < 0)
+	int64_t calibration[CALIBRATION_NWORDS];
+	char key[BACKLIGHT_KEYLEN];
+	int i, calibrated = 1;
+
+	for (i = 0; i < nitems(calibration); i++) {
+		snprintf(key, sizeof(key), "%s_%s%d", c->bc_name,
+			 BACKLIGHT_CALIBRATION, i);
+		calibration[i] = nvlist_exists_number(cf, key) ?
+			(int64_t)nvlist_get_number(cf, key) : 0;
+		calibrated = calibrated && nvlist_exists_number(cf, key);
+	}
+	/* calibrated by another process, the table is made again */
+	if (calibrated != c->bc_calibrated ||
+	    memcmp(calibration, c->bc_calibration, sizeof(calibration)) != 0)
+		c->bc_table.lt_nlevels = 0;
+	c->bc_calibrated = calibrated;
+	memcpy(c->bc_calibration, calibration, sizeof(calibration));
+
+	if (conf_get_int(cf, c->bc_eco_key, &c->bc_economy_level) < 0 ||
+	    conf_get_int(cf, c->bc_ful_key, &c->bc_fullpower_level) < 0 ||
+	    conf_get_int(cf, c->bc_cur_key, &c->bc_current_level) < 0)
 		return -1;
 
 	return 0;
@@ -128,9 +345,18 @@ backlight_save_conf(void *context, nvlist_t *cf)
 {
 	struct backlight_context *c = context;
 
-	nvlist_add_number(cf, BACKLIGHT_ECO_LEVEL, c->bc_economy_level);
-	nvlist_add_number(cf, BACKLIGHT_FUL_LEVEL, c->bc_fullpower_level);
-	nvlist_add_number(cf, BACKLIGHT_CUR_LEVEL, c->bc_current_level);
+	char key[BACKLIGHT_KEYLEN];
+	int i;
+
+	nvlist_add_number(cf, c->bc_eco_key, c->bc_economy_level);
+	nvlist_add_number(cf, c->bc_ful_key, c->bc_fullpower_level);
+	nvlist_add_number(cf, c->bc_cur_key, c->bc_current_level);
+
+	for (i = 0; c->bc_calibrated && i < nitems(c->bc_calibration); i++) {
+		snprintf(key, sizeof(key), "%s_%s%d", c->bc_name,
+			 BACKLIGHT_CALIBRATION, i);
+		nvlist_add_number(cf, key, c->bc_calibration[i]);
+	}
 
 	return 0;
 }
@@ -170,38 +396,63 @@ backlight_cleanup(void *context)
 	struct backlight_context *c = context;
 
 	if (c->bc_fd != -1) {
-		close(c->bc_fd);
+		HW_CLOSE(c->bc_fd);
 		c->bc_fd = -1;
 	}
-	free(c->bc_levels);
 
 	return 0;
 }
 
+/* write the brightness, called for each frame of the fade */
 static int
-set_backlight_video_level(struct backlight_context *c, int val) {
+write_backlight_video_level(void *context, int val)
+{
+	struct backlight_context *c = context;
 	/* struct containing backlight(9) properties */
 	struct backlight_props props;
 
-	if (val < 0 || val > 100)
-		return -1;
+	/* the level that shows the nearest visible level */
+	props.brightness = (c->bc_calibrated && c->bc_table.lt_nlevels > 0) ?
+		c->bc_write[level_nearest(&c->bc_table, val)] : val;
 
-	props.brightness = val;
-
-	if (ioctl(c->bc_fd, BACKLIGHTUPDATESTATUS, &props) < 0) {
+	if (HW_IOCTL(c->bc_fd, BACKLIGHTUPDATESTATUS, &props) < 0) {
 		fprintf(stderr, "ioctl BACKLIGHTUPDATESTATUS : %s\n",
 			strerror(errno));
 		return -1;
 	}
+	conf_count(STAT_HW_WRITES, 1);
 
-	printf("set backlight brightness: %d\n", val);
+	return 0;
+}
+
+/*
+  Set the level. The same level as the current one is not written unless
+  ASMC_SET_FORCE is set, the hardware may be reset by a boot, a resume or
+  the firmware on an AC power change. The level for the AC power status
+  is kept with ASMC_SET_CURRENT.
+ */
+static int
+set_backlight_video_level(struct backlight_context *c, int val, int flags) {
+	if (val < 0 || val > 100)
+		return -1;
+
+	/* skip writing the same level, or write it at once */
+	if (val == c->bc_current_level && ! (flags & ASMC_SET_FORCE))
+		conf_count(STAT_HW_WRITES_SKIPPED, 1);
+	else if (fade_to(&c->bc_fade, (val == c->bc_current_level) ? -1 :
+			 c->bc_current_level, val) < 0)
+		return -1;
 
-	c->bc_current_level = val;
+	output_text("set %s brightness: %d\n", c->bc_name, val);
+
+	conf_set_int(&c->bc_current_level, val);
+	if (flags & ASMC_SET_CURRENT)
+		return 0;
 
 	if (ac_powered)
-		c->bc_fullpower_level = val;
+		conf_set_int(&c->bc_fullpower_level, val);
 	else
-		c->bc_economy_level = val;
+		conf_set_int(&c->bc_economy_level, val);
 
 	return 0;
 }
@@ -213,109 +464,141 @@ backlight_event(void *context)
 	int alv = choose_acpi_level(c->bc_economy_level,
 				    c->bc_fullpower_level);
 
-	return set_backlight_video_level(c, alv);
+	/* the saved level may not be visible */
+	if (c->bc_calibrated) {
+		if (get_backlight_video_levels(c) < 0)
+			return -1;
+		alv = level_nearest(&c->bc_table, alv);
+	}
+
+	return set_backlight_video_level(c, alv, ASMC_SET_FORCE);
 }
 
 static int
-get_video_up_level(struct backlight_context *c)
+backlight_nsteps(struct backlight_context *c)
 {
-	int i, v = c->bc_current_level;
+	return c->bc_levels_are_generated ? BACKLIGHT_NSTEPS :
+		c->bc_table.lt_nlevels - 1;
+}
 
-	/* A bug(?) exists on some screens that make it impossible to raise the
-	   backlight properly:
+static int
+backlight_up(void *context, int steps)
+{
+	struct backlight_context *c = context;
 
-	   $ backlight 80
-	   $ backlight
-	   brightness: 79
-	   $ backlight 75
-	   $ backlight
-	   brightness: 74
+	if (get_backlight_video_levels(c) < 0)
+		return -1;
 
-	   This line therefore raises the backlight by two
-	*/
-	if (c->bc_levels_are_generated && v < 100)
-		v++;
+	return set_backlight_video_level(c, level_curve_step(&c->bc_table,
+		backlight_nsteps(c), c->bc_current_level, steps), 0);
+}
 
-	for (i = 0; i < c->bc_nlevels; i++)
-		if (c->bc_levels[i] == v)
-			return c->bc_levels[MIN(i + 1, c->bc_nlevels - 1)];
+static int
+backlight_down(void *context, int steps)
+{
+	struct backlight_context *c = context;
 
-	return -1;
+	if (get_backlight_video_levels(c) < 0)
+		return -1;
+
+	return set_backlight_video_level(c, level_curve_step(&c->bc_table,
+		backlight_nsteps(c), c->bc_current_level, -steps), 0);
 }
 
 static int
-backlight_up(void *context)
+backlight_set(void *context, int val, int flags)
 {
 	struct backlight_context *c = context;
 
 	if (get_backlight_video_levels(c) < 0)
 		return -1;
 
-	return set_backlight_video_level(c, get_video_up_level(c));
+	return set_backlight_video_level(c, (flags & ASMC_SET_PERCENT) ?
+					 level_percent(&c->bc_table, val) :
+					 level_nearest(&c->bc_table, val),
+					 flags & ASMC_SET_CURRENT);
+}
 
+static int
+backlight_get_levels(void *context, struct asmc_levels *l)
+{
+	struct backlight_context *c = context;
+
+	l->al_current = c->bc_current_level;
+	l->al_economy = c->bc_economy_level;
+	l->al_fullpower = c->bc_fullpower_level;
+	return 0;
 }
 
 static int
-get_video_down_level(struct backlight_context *c)
+backlight_read_level(void *context, int *val)
 {
-	int i, v = c->bc_current_level;
-
-	/* A bug(?) exists on some screens that make it impossible to decrease
-	   the backlight properly.
-
-	   For example, the only way to decrease from 80 to 79 is by
-	   either first increasing to 81 and setting backlight=80, or
-	   decreasing to 79 and setting backlight=80:
-
-	   $ backlight
-	   brightness: 80
-	   $ backlight 79
-	   $ backlight
-	   brightness: 78
-	   $ backlight
-	   brightness: 79
-
-	   Attempting to set backlight=80 (to actually set backlight=79)
-	   fails, as setting the current value of backlight does not
-	   change its value:
-
-	   $ backlight
-	   brightness: 80
-	   $ backlight 80
-	   $ backlight
-	   brightness: 80
-	   $ backlight 79
-	   $ backlight
-	   brightness: 78
-
-	   Therefore, this function, if using backlight(9), will decrease at a
-	   minimum level of 2.
-
-	   The only way to set the backlight to truly dim is by setting
-	   backlight=0 when the backlight=1 is not previously set. The follow
-	   line assures that if backlight=2, it does not set backlight=1 but
-	   instead backlight=0.
-	*/
-
-	if (c->bc_levels_are_generated && v >= 2)
-		v--;
-
-	for (i = c->bc_nlevels - 1; i >= 0; i--)
-		if (c->bc_levels[i] == v)
-			return c->bc_levels[MAX(0, i - 1)];
-
-	return -1;
+	struct backlight_context *c = context;
+	struct backlight_props props;
+
+	if (HW_IOCTL(c->bc_fd, BACKLIGHTGETSTATUS, &props) < 0) {
+		fprintf(stderr, "ioctl BACKLIGHTGETSTATUS : %s\n",
+			strerror(errno));
+		return -1;
+	}
+	*val = props.brightness;
+	return 0;
 }
 
+/*
+  Write each level and read back the brightness that the panel shows.
+  Some panels round a brightness down, the levels are stepped on the
+  visible ones afterwards and each of them is written by one ioctl.
+ */
 static int
-backlight_down(void *context)
+backlight_calibrate(void *context)
 {
 	struct backlight_context *c = context;
+	struct backlight_props props;
+	int64_t calibration[CALIBRATION_NWORDS];
+	int i, n, drop, level, buf[CACHE_MAXVALUES];
 
-	if (get_backlight_video_levels(c) < 0)
+	if (get_backlight_video_levels(c) < 0 ||
+	    (n = read_backlight_video_levels(c, buf, nitems(buf))) < 0)
 		return -1;
+	level = c->bc_current_level;
+
+	memset(calibration, 0, sizeof(calibration));
+	for (i = 1; i < n; i++) {
+		props.brightness = buf[i];
+		if (HW_IOCTL(c->bc_fd, BACKLIGHTUPDATESTATUS, &props) < 0 ||
+		    HW_IOCTL(c->bc_fd, BACKLIGHTGETSTATUS, &props) < 0) {
+			fprintf(stderr, "ioctl %s : %s\n", c->bc_name,
+				strerror(errno));
+			return -1;
+		}
+		conf_count(STAT_HW_WRITES, 1);
+
+		drop = buf[i] - props.brightness;
+		if (drop < 0 || drop > CALIBRATION_MAXDROP) {
+			fprintf(stderr, "%s shows %d for %d, "
+				"can not calibrate\n", c->bc_name,
+				props.brightness, buf[i]);
+			return -1;
+		}
+		calibration[buf[i] / CALIBRATION_PER_WORD] |= (int64_t)drop <<
+			(buf[i] % CALIBRATION_PER_WORD * CALIBRATION_BITS);
+	}
+
+	for (i = 0; i < nitems(calibration); i++)
+		conf_set_int64(&c->bc_calibration[i], calibration[i]);
+	conf_set_int(&c->bc_calibrated, 1);
+	if (init_calibrated_table(c, &buf[1], n - 1) < 0)
+		return -1;
+
+	output_text("calibrate %s: %d visible levels of %d\n", c->bc_name,
+		    c->bc_table.lt_nlevels, n - 1);
 
-	return set_backlight_video_level(c, get_video_down_level(c));
+	/* back to the level before, the last one written is shown */
+	c->bc_current_level = props.brightness;
+	return set_backlight_video_level(c, level_nearest(&c->bc_table,
+							  level),
+					 ASMC_SET_CURRENT);
 }
 
 struct asmc_driver backlight_driver =
@@ -332,5 +615,9 @@ struct asmc_driver backlight_driver =
 	.cleanup = backlight_cleanup,
 	.acpi_event = backlight_event,
 	.up = backlight_up,
-	.down = backlight_down
+	.down = backlight_down,
+	.set = backlight_set,
+	.get_levels = backlight_get_levels,
+	.read_level = backlight_read_level,
+	.calibrate = backlight_calibrate
 };
@@ -0,0 +1,895 @@
+/*-
+ * Copyright (c) 2026 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Benchmark of the keypress path on the fake hardware.
+ *
+ * Each cycle runs the same steps as asmctl(1) does without asmctld(8),
+ * from the driver initialization to storing the state file, and the
+ * latency of the cycles is reported in percentiles.
+ *
+ * The AC power notifications are also sent from a fake devd(8) to the
+ * listener of asmctld(8), and the events handled per second are reported.
+ * Storms of the notifications are replayed with and without the settle
+ * window to count the writes suppressed.
+ *
+ * The auto-brightness of asmctld(8) is replayed on an hour of the
+ * ambient light to count the samples and the writes.
+ *
+ * The keypresses and the AC power notifications are run in concurrent
+ * processes on the shared fake hardware, to check that no step is lost
+ * and to measure the invocations per second.
+ *
+ * The idle dimming of asmctld(8) is replayed on a workday of the
+ * keyboard inputs to count the wakeups of the event loop.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "asmctl.h"
+
+#define AC_POWER "hw.acpi.acline"
+#define LIGHT_LEFT "dev.asmc.0.light.left"
+#define LIGHT_RIGHT "dev.asmc.0.light.right"
+#define KEY_LIGHT "dev.asmc.0.light.control"
+
+/* the fake backlight(9) devices */
+#define BENCH_BACKLIGHTS  2
+
+/* replay of the ambient light */
+#define LIGHT_REPLAY_MSEC  (60 * 60 * 1000)
+
+/* storms of the AC power notifications by a loose connector */
+#define AC_STORMS        200
+#define AC_STORM_EVENTS  30  /* at most in a storm */
+
+/* the concurrent invocations of asmctl(1) */
+#define STRESS_MAXPROCS  16
+#define STRESS_STEPS     96  /* 'key up' of a round, from 0 */
+#define STRESS_ACPI      4   /* 'all acpi' after the steps */
+#define STRESS_ROUNDS    10
+
+/* a panel that shows only the even brightness */
+#define PANEL_QUANTUM  2
+
+/* replay of the keyboard inputs */
+#define IDLE_REPLAY_MSEC     (8 * 60 * 60 * 1000)
+#define IDLE_REPLAY_TIMEOUT  30000
+#define IDLE_REPLAY_LEVEL    60
+
+/* the notifications of devd(8) on AC power changes */
+static const char *devd_messages[] = {
+	"!system=ACPI subsystem=ACAD type=\\_SB_.PCI0.AC notify=0x00\n",
+	"!system=ACPI subsystem=ACAD type=\\_SB_.PCI0.AC notify=0x01\n",
+};
+
+struct scenario {
+	const char *sc_name;
+	/* commands of a cycle */
+	const char *sc_commands[2];
+	/* a command to get out of the limit, not measured */
+	const char *sc_reset;
+	int sc_reset_period;
+	int sc_toggle_ac;
+};
+
+static const struct scenario scenarios[] = {
+	{"video up", {"video up"}, "video set 0", 8, 0},
+	{"key down", {"key down"}, "key set 100", 8, 0},
+	/* devd(8) runs it on an ACAD event */
+	{"all acpi", {"all acpi"}, NULL, 0, 1},
+};
+
+/* the output, the drivers print to the stdout */
+static FILE *out;
+
+/* the driver and the number of the units of the last command */
+static char driver_name[32] = "-";
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n cycles] [-l usec] [-g usec] "
+		"[-S sysfs]\n", prog);
+	fprintf(stderr, "\nMeasure asmctl commands on the fake hardware.\n");
+}
+
+/*
+  The same steps as asmctl(1). The steps of up and down are passed to
+  the leader if 'coalesce' is set.
+ */
+static int
+execute(const char *command, int coalesce)
+{
+	char buf[ASMCTLD_MSGSIZE], *p, *argv[BATCH_MAXARGS];
+	struct asmc_batch batch;
+	int i, argc = 0, leader = -1, rc = -1;
+
+	strlcpy(buf, command, sizeof(buf));
+	for (p = buf; argc < nitems(argv) &&
+		     (argv[argc] = strsep(&p, " ")) != NULL; argc++)
+		;
+
+	if (parse_batch(argc, argv, &batch) < 0)
+		return -1;
+
+	if (open_conf_file() < 0)
+		goto end;
+	open_cache_file();
+
+	if (coalesce && (leader = coalesce_batch(&batch)) == 0) {
+		rc = 0;
+		goto end;
+	}
+
+	if (init_batch_context(&batch) < 0)
+		goto end;
+	for (i = 1; i < ASMC_MAXUNITS &&
+		     asmc_context(batch.ab_ops[0].bo_cat, i)->driver != NULL; i++)
+		;
+	snprintf(driver_name, sizeof(driver_name), (i > 1) ? "%s*%d" : "%s",
+		 asmc_context(batch.ab_ops[0].bo_cat, 0)->driver->name, i);
+
+	if (batch_ac_powered(&batch) < 0)
+		goto end;
+
+	if (leader > 0)
+		rc = asmc_lead(batch.ab_ops[0].bo_cat);
+	else {
+		/* the locks are released by cleanup() on error */
+		if (conf_lock(batch_categories(&batch)) < 0 ||
+		    get_saved_levels() < 0)
+			goto end;
+		rc = asmc_operate_batch(&batch, 1);
+		store_conf_file();
+		conf_unlock(batch_categories(&batch));
+	}
+	output_write(STDOUT_FILENO);
+end:
+	cleanup();
+	return rc;
+}
+
+static int
+run(const char *command)
+{
+	return execute(command, 0);
+}
+
+/*
+  Change the AC power, and record it by 'all acpi' as devd(8) runs on
+  the event. Up and down use the recorded status.
+ */
+static int
+plug_ac(int powered)
+{
+	if (hw_fake_set(AC_POWER, powered) < 0)
+		return -1;
+	return run("all acpi");
+}
+
+static int
+compare_nsec(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* returns the 99th percentile in microseconds, or -1 on error. */
+static long
+measure(const struct scenario *s, int ncycles, long *nsec)
+{
+	struct timespec t0, t1;
+	unsigned long calls = 0, c0;
+	int i, j, ac;
+	const char *const *cmd, *name = "-";
+
+	for (i = 0; i < ncycles; i++) {
+		if (s->sc_reset != NULL && i % s->sc_reset_period == 0 &&
+		    run(s->sc_reset) < 0)
+			return -1;
+		if (s->sc_toggle_ac && hw_fake_get(AC_POWER, &ac) == 0)
+			hw_fake_set(AC_POWER, ! ac);
+
+		c0 = hw_fake_calls;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (j = 0; j < nitems(s->sc_commands); j++) {
+			cmd = &s->sc_commands[j];
+			if (*cmd != NULL && run(*cmd) < 0)
+				return -1;
+			if (j == 0)
+				name = driver_name;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		calls += hw_fake_calls - c0;
+
+		nsec[i] = (t1.tv_sec - t0.tv_sec) * 1000000000L +
+			(t1.tv_nsec - t0.tv_nsec);
+	}
+
+	qsort(nsec, ncycles, sizeof(long), compare_nsec);
+
+	fprintf(out, "%-16s %-10s %8d %10.1f %10.1f %8.1f\n",
+		name, s->sc_name, ncycles,
+		nsec[ncycles / 2] / 1000.0,
+		nsec[MIN(ncycles * 99 / 100, ncycles - 1)] / 1000.0,
+		(double)calls / ncycles);
+
+	return nsec[MIN(ncycles * 99 / 100, ncycles - 1)] / 1000;
+}
+
+/* a fake devd(8) that the listener connects to */
+static int
+devd_server(const char *path)
+{
+	struct sockaddr_un sun;
+	int s;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_LOCAL;
+	strlcpy(sun.sun_path, path, sizeof(sun.sun_path));
+
+	if ((s = socket(PF_LOCAL, SOCK_SEQPACKET, 0)) < 0)
+		return -1;
+	if (bind(s, (struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+	    listen(s, 1) < 0) {
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+/*
+  The same steps as the devd(8) listener of asmctld(8).
+  Returns the events handled per second, or -1 on error.
+ */
+static double
+measure_devd(const char *path, int ncycles, long *nsec)
+{
+	struct timespec t0, t1, start;
+	char buf[DEVD_MSGSIZE];
+	const char *msg;
+	unsigned long calls = 0, c0;
+	int i, s, d = -1, c = -1;
+	ssize_t len;
+	double rate = -1;
+
+	/* different levels on AC power and on battery */
+	if (plug_ac(0) < 0 || run("all set 0") < 0 ||
+	    plug_ac(1) < 0 || run("all set 100") < 0)
+		return -1;
+
+	unlink(path);
+	if ((s = devd_server(path)) < 0)
+		return -1;
+	devd_socket = (char *)path;
+
+	/* the drivers are kept as the daemon does */
+	output_mode = OUTPUT_QUIET;
+	devd_settle_msec = 0;
+	if (open_conf_file() < 0)
+		goto end;
+	open_cache_file();
+	if (init_driver_context() < 0 || get_ac_powered() < 0 ||
+	    get_saved_levels() < 0)
+		goto end;
+
+	if ((c = devd_open(devd_socket)) < 0 ||
+	    (d = accept(s, NULL, NULL)) < 0)
+		goto end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < ncycles; i++) {
+		msg = devd_messages[i % nitems(devd_messages)];
+
+		c0 = hw_fake_calls;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (send(d, msg, strlen(msg), 0) < 0 ||
+		    (len = recv(c, buf, sizeof(buf) - 1, 0)) <= 0)
+			goto end;
+		buf[len] = '\0';
+		if (devd_handle(buf) <= 0)
+			goto end;
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		calls += hw_fake_calls - c0;
+
+		nsec[i] = (t1.tv_sec - t0.tv_sec) * 1000000000L +
+			(t1.tv_nsec - t0.tv_nsec);
+	}
+
+	rate = ncycles / ((t1.tv_sec - start.tv_sec) +
+			  (t1.tv_nsec - start.tv_nsec) / 1e9);
+
+	qsort(nsec, ncycles, sizeof(long), compare_nsec);
+
+	fprintf(out, "%-16s %-10s %8d %10.1f %10.1f %8.1f\n",
+		"devd", "ACAD", ncycles,
+		nsec[ncycles / 2] / 1000.0,
+		nsec[MIN(ncycles * 99 / 100, ncycles - 1)] / 1000.0,
+		(double)calls / ncycles);
+end:
+	if (c != -1)
+		close(c);
+	if (d != -1)
+		close(d);
+	close(s);
+	unlink(path);
+	cleanup();
+	output_mode = OUTPUT_TEXT;
+	return rate;
+}
+
+/*
+  Replay the storms to the devd(8) listener without and with the settle
+  window. The events of a storm come within the window and the window
+  passes after the last one.
+ */
+static int
+replay_ac_storms(void)
+{
+	char msg[DEVD_MSGSIZE];
+	long events = 0, writes[2], w0;
+	int i, j, n, pass, rc = -1;
+
+	/* different levels on AC power and on battery */
+	if (plug_ac(0) < 0 || run("all set 0") < 0 ||
+	    plug_ac(1) < 0 || run("all set 100") < 0)
+		return -1;
+
+	output_mode = OUTPUT_QUIET;
+	for (pass = 0; pass < 2; pass++) {
+		devd_settle_msec = pass ? DEVD_SETTLE : 0;
+		if (open_conf_file() < 0)
+			goto end;
+		open_cache_file();
+		if (init_driver_context() < 0 || get_ac_powered() < 0 ||
+		    get_saved_levels() < 0)
+			goto end;
+
+		/* the same storms in both passes */
+		srandom(1);
+		events = 0;
+		w0 = conf_stat(STAT_HW_WRITES);
+		for (i = 0; i < AC_STORMS; i++) {
+			n = 1 + random() % AC_STORM_EVENTS;
+			for (j = 0; j < n; j++, events++) {
+				strlcpy(msg, devd_messages[random() % 2],
+					sizeof(msg));
+				if (devd_handle(msg) <= 0)
+					goto end;
+			}
+			if (devd_settle() < 0)
+				goto end;
+		}
+		writes[pass] = conf_stat(STAT_HW_WRITES) - w0;
+		cleanup();
+	}
+
+	fprintf(out, "\nac storm replay: %ld events, %ld writes without "
+		"the settle window, %ld with it, %ld suppressed\n", events,
+		writes[0], writes[1], writes[0] - writes[1]);
+	rc = 0;
+end:
+	cleanup();
+	output_mode = OUTPUT_TEXT;
+	return rc;
+}
+
+/*
+  The ambient light of an hour. A dark room, the sun rises, a lamp is
+  turned off and on again, with the noise of the sensor.
+ */
+static int
+ambient_light(long msec)
+{
+	long min = msec / 60000;
+	int light;
+
+	if (min < 10)
+		light = 10;
+	else if (min < 20)
+		light = 10 + (int)((msec - 600000) * 490 / 600000);
+	else if (min < 40)
+		light = 500;
+	else if (min < 41)
+		light = 50;
+	else
+		light = 400;
+
+	return MAX(0, light + (int)(random() % 11 - 5) * light / 50);
+}
+
+/* the same steps as the auto-brightness of asmctld(8) */
+static int
+replay_light(void)
+{
+	unsigned long calls, c0;
+	long msec = 0, samples, writes;
+	int rc = -1;
+
+	output_mode = OUTPUT_QUIET;
+	if (open_conf_file() < 0)
+		goto end;
+	open_cache_file();
+	if (init_driver_context() < 0 || get_ac_powered() < 0 ||
+	    get_saved_levels() < 0 || light_start() < 0)
+		goto end;
+
+	srandom(1);
+	samples = conf_stat(STAT_LIGHT_SAMPLES);
+	writes = conf_stat(STAT_LIGHT_WRITES);
+	c0 = hw_fake_calls;
+	while (msec < LIGHT_REPLAY_MSEC) {
+		hw_fake_set(LIGHT_LEFT, ambient_light(msec));
+		hw_fake_set(LIGHT_RIGHT, ambient_light(msec) * 9 / 10);
+		msec += light_sample();
+	}
+	calls = hw_fake_calls - c0;
+	samples = conf_stat(STAT_LIGHT_SAMPLES) - samples;
+	writes = conf_stat(STAT_LIGHT_WRITES) - writes;
+
+	fprintf(out, "\nlight replay of an hour: %ld samples, %ld writes, "
+		"%.1f calls per sample\n", samples, writes,
+		(double)calls / samples);
+	rc = 0;
+end:
+	cleanup();
+	output_mode = OUTPUT_TEXT;
+	return rc;
+}
+
+/*
+  A process of the stress test. Every other step is coalesced as a key
+  repeat, the others are applied by the process as the commands of a
+  script, and devd(8) fires during them.
+ */
+static int
+stress_process(int steps)
+{
+	int i;
+
+	for (i = 1; i <= steps; i++)
+		if (execute("key up", i % 2) < 0 ||
+		    (i % STRESS_ACPI == 0 && execute("all acpi", 0) < 0))
+			return -1;
+	return 0;
+}
+
+/*
+  Run 'key up' and 'all acpi' in the concurrent processes, and check
+  that no step is lost in the hardware and the state file. The
+  invocations per second are reported as the processes grow.
+ */
+static int
+stress(void)
+{
+	struct timespec t0, t1;
+	struct asmc_levels l;
+	pid_t pid;
+	long invocations, nsec;
+	int i, n, round, status, level, driver, steps, lost, stale;
+	int failed = 0, rc = -1;
+
+	/* a step is a level, 'all acpi' keeps the level on AC power */
+	output_mode = OUTPUT_QUIET;
+	curve_steps = LEVEL_MAX;
+	if (plug_ac(1) < 0)
+		goto end;
+
+	fprintf(out, "\n%-8s %12s %12s %8s %8s\n", "procs", "invocations",
+		"per second", "lost", "stale");
+	for (n = 1; n <= STRESS_MAXPROCS; n *= 2) {
+		steps = STRESS_STEPS / n;
+		invocations = nsec = 0;
+		lost = stale = 0;
+		for (round = 0; round < STRESS_ROUNDS; round++) {
+			if (run("key set 0") < 0)
+				goto end;
+
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			for (i = 0; i < n; i++) {
+				if ((pid = fork()) < 0) {
+					fprintf(stderr, "fork: %s\n",
+						strerror(errno));
+					goto end;
+				}
+				if (pid == 0)
+					_exit(stress_process(steps) < 0);
+			}
+			while (wait(&status) > 0)
+				if (! WIFEXITED(status) ||
+				    WEXITSTATUS(status) != 0)
+					failed = 1;
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			if (failed)
+				goto end;
+			invocations += n * (steps + steps / STRESS_ACPI);
+			nsec += (t1.tv_sec - t0.tv_sec) * 1000000000L +
+				(t1.tv_nsec - t0.tv_nsec);
+
+			/* the levels after all of the steps */
+			if (hw_fake_get(KEY_LIGHT, &level) < 0 ||
+			    open_conf_file() < 0)
+				goto end;
+			if (conf_get_status(KEYBOARD, 0, &driver, &l) < 0)
+				l.al_current = -1;
+			close_conf_file();
+			lost += n * steps - level;
+			stale += (l.al_current != level);
+		}
+
+		fprintf(out, "%-8d %12ld %12.0f %8d %8d\n", n, invocations,
+			invocations * 1e9 / nsec, lost, stale);
+		if (lost != 0 || stale != 0)
+			goto end;
+	}
+	rc = 0;
+end:
+	curve_steps = 0;
+	output_mode = OUTPUT_TEXT;
+	return rc;
+}
+
+#ifdef HAVE_SYS_BACKLIGHT_H
+/* the panel is a backlight(9) device */
+static long
+hw_writes(void)
+{
+	long n;
+
+	if (open_conf_file() < 0)
+		return -1;
+	n = conf_stat(STAT_HW_WRITES);
+	close_conf_file();
+	return n;
+}
+
+/*
+  Step up a panel that rounds the brightness down from the darkest to
+  the brightest, before and after 'video calibrate', and count the
+  presses that change nothing visible.
+ */
+static int
+replay_calibration(void)
+{
+	int pass, presses, wasted, prev, cur, rc = -1;
+	long writes;
+
+	output_mode = OUTPUT_QUIET;
+	hw_fake_panel(PANEL_QUANTUM);
+	for (pass = 0; pass < 2; pass++) {
+		if ((pass == 1 && run("video calibrate") < 0) ||
+		    run("video set 0") < 0 || hw_fake_brightness(0, &prev) < 0 ||
+		    (writes = hw_writes()) < 0)
+			goto end;
+
+		for (presses = wasted = 0; prev < LEVEL_MAX; presses++) {
+			if (run("video:0 up") < 0 ||
+			    hw_fake_brightness(0, &cur) < 0 ||
+			    presses > LEVEL_MAX)
+				goto end;
+			if (cur == prev)
+				wasted++;
+			prev = cur;
+		}
+
+		fprintf(out, "%s%s calibration: %d presses to the top, "
+			"%d without a visible change, %.1f writes per press\n",
+			pass ? "" : "\npanel of even levels\n",
+			pass ? "after" : "before", presses, wasted,
+			(double)(hw_writes() - writes) / presses);
+	}
+	rc = 0;
+end:
+	hw_fake_panel(1);
+	output_mode = OUTPUT_TEXT;
+	return rc;
+}
+#endif
+
+/*
+  Msec from 'now' to the next keyboard input of a workday. Typing,
+  reading and being away take turns for minutes.
+ */
+static long
+next_input(long now)
+{
+	static long phase_end = 0;
+	static int phase;
+
+	/* away once in 5 turns */
+	while (now >= phase_end) {
+		phase = random() % 5;
+		phase_end = now + (1 + random() % (phase == 4 ? 45 : 10)) *
+			60000;
+	}
+
+	switch (phase) {
+	case 0:
+	case 1:
+		return 50 + random() % 350;
+	case 2:
+	case 3:
+		return 2000 + random() % 23000;
+	default:
+		/* the input of coming back */
+		return phase_end - now;
+	}
+}
+
+/*
+  The same steps as the idle dimming of asmctld(8) on the time of the
+  workday. The keyboard must be dimmed without a wakeup until the next
+  input, and lit again at the saved level.
+ */
+static int
+replay_idle(void)
+{
+	struct asmc_levels l;
+	long now = 0, last = 0, deadline, next, dimmed_at = 0, dimmed = 0;
+	long inputs = 0;
+	long input_wakeups, timer_wakeups, dims;
+	int level, driver, pending = 0, failed = 0, rc = -1;
+	char command[32];
+
+	output_mode = OUTPUT_QUIET;
+	snprintf(command, sizeof(command), "key set %d", IDLE_REPLAY_LEVEL);
+	if (run(command) < 0 ||
+	    open_conf_file() < 0)
+		goto end;
+	open_cache_file();
+	if (init_driver_context() < 0 || get_ac_powered() < 0 ||
+	    get_saved_levels() < 0)
+		goto end;
+
+	srandom(1);
+	idle_timeout_msec = IDLE_REPLAY_TIMEOUT;
+	/* the time is replayed, the dim doesn't sleep */
+	idle_fade_msec = 0;
+	input_wakeups = conf_stat(STAT_IDLE_INPUT_WAKEUPS);
+	timer_wakeups = conf_stat(STAT_IDLE_TIMER_WAKEUPS);
+	dims = conf_stat(STAT_IDLE_DIMS);
+
+	deadline = idle_reset(now);
+	while (now < IDLE_REPLAY_MSEC) {
+		last = now;
+		now += next_input(now);
+		inputs++;
+
+		/* the timer expires before the input */
+		while (deadline >= 0 && deadline <= now) {
+			next = idle_expire(deadline, pending);
+			pending = 0;
+			if (idle_is_dimmed()) {
+				/* checked a few times late at most */
+				dimmed_at = deadline;
+				if (deadline - last < IDLE_REPLAY_TIMEOUT ||
+				    deadline - last > IDLE_REPLAY_TIMEOUT +
+				    IDLE_REPLAY_TIMEOUT / IDLE_CHECKS ||
+				    next >= 0 ||
+				    hw_fake_get(KEY_LIGHT, &level) < 0 ||
+				    level != 0)
+					failed++;
+			}
+			deadline = (next < 0) ? -1 : deadline + next;
+		}
+
+		/* the source is checked by the timer */
+		if (! idle_watching()) {
+			pending = 1;
+			continue;
+		}
+
+		if (idle_is_dimmed())
+			dimmed += now - dimmed_at;
+		deadline = now + idle_input(now);
+		if (hw_fake_get(KEY_LIGHT, &level) < 0 ||
+		    level != IDLE_REPLAY_LEVEL)
+			failed++;
+	}
+	input_wakeups = conf_stat(STAT_IDLE_INPUT_WAKEUPS) - input_wakeups;
+	timer_wakeups = conf_stat(STAT_IDLE_TIMER_WAKEUPS) - timer_wakeups;
+	dims = conf_stat(STAT_IDLE_DIMS) - dims;
+
+	/* dimming doesn't change the saved level */
+	if (conf_get_status(KEYBOARD, 0, &driver, &l) < 0 ||
+	    l.al_current != IDLE_REPLAY_LEVEL)
+		failed++;
+
+	fprintf(out, "\nidle replay of a workday: %ld inputs, %ld wakeups "
+		"(%ld timer), %ld dims\n%ld minutes dimmed without a wakeup, "
+		"%d wakeups by polling a second, %d failed checks\n", inputs,
+		input_wakeups + timer_wakeups, timer_wakeups, dims,
+		dimmed / 60000, IDLE_REPLAY_MSEC / 1000, failed);
+	if (failed == 0)
+		rc = 0;
+end:
+	idle_timeout_msec = 0;
+	idle_fade_msec = IDLE_FADE;
+	idle_reset(0);
+	cleanup();
+	output_mode = OUTPUT_TEXT;
+	return rc;
+}
+
+int
+main(int argc, char *argv[])
+{
+	char dir[] = "/tmp/asmctl-bench.XXXXXX";
+	char conf[PATH_MAX], cache[PATH_MAX], devd[PATH_MAX];
+	char bldir[PATH_MAX], path[PATH_MAX];
+	int i, ch, backlight, ncycles = 2000, rc = 0;
+	long p99, gate = 0, latency = 0, *nsec;
+	double rate[BENCH_BACKLIGHTS + 1];
+	const struct scenario *s;
+
+	while ((ch = getopt(argc, argv, "n:l:g:S:")) != -1) {
+		switch (ch) {
+		case 'n':
+			ncycles = strtol(optarg, NULL, 10);
+			break;
+		case 'l':
+			latency = strtol(optarg, NULL, 10);
+			break;
+		case 'g':
+			gate = strtol(optarg, NULL, 10);
+			break;
+		case 'S':
+			sysfs_root = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (ncycles < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if ((nsec = malloc(sizeof(long) * ncycles)) == NULL) {
+		fprintf(stderr, "failed to allocate %zu bytes memory\n",
+			sizeof(long) * ncycles);
+		return 1;
+	}
+
+	if (mkdtemp(dir) == NULL) {
+		fprintf(stderr, "mkdtemp %s : %s\n", dir, strerror(errno));
+		return 1;
+	}
+	snprintf(conf, sizeof(conf), "%s/asmctl.conf", dir);
+	snprintf(cache, sizeof(cache), "%s/asmctl.cache", dir);
+	snprintf(devd, sizeof(devd), "%s/devd.pipe", dir);
+	snprintf(bldir, sizeof(bldir), "%s/backlight", dir);
+	conf_filename = conf;
+	cache_filename = cache;
+
+	/* the fake backlight(9) devices, opened by the fake hardware */
+	backlight_dir = bldir;
+	mkdir(bldir, 0755);
+	for (i = 0; i < BENCH_BACKLIGHTS; i++) {
+		if (snprintf(path, sizeof(path), "%s/backlight%d", bldir,
+			     i) >= sizeof(path)) {
+			fprintf(stderr, "too long path: %s\n", bldir);
+			return 1;
+		}
+		close(open(path, O_CREAT | O_WRONLY, 0644));
+	}
+
+	/* no sysfs drivers unless the fake tree is given */
+	if (strcmp(sysfs_root, "/sys") == 0)
+		sysfs_root = dir;
+
+	if ((out = fdopen(dup(STDOUT_FILENO), "w")) == NULL ||
+	    freopen("/dev/null", "w", stdout) == NULL) {
+		fprintf(stderr, "can not redirect stdout\n");
+		return 1;
+	}
+
+	fprintf(out, "%-16s %-10s %8s %10s %10s %8s\n", "driver", "command",
+		"cycles", "p50(us)", "p99(us)", "calls");
+
+	/* without the backlight(9) device, with one and with several */
+	for (backlight = 0; backlight <= BENCH_BACKLIGHTS; backlight++) {
+		hw_fake_init(latency, backlight);
+		unlink(conf);
+		unlink(cache);
+		ARRAY_FOREACH(s, scenarios) {
+			if ((p99 = measure(s, ncycles, nsec)) < 0) {
+				fprintf(stderr, "%s failed\n", s->sc_name);
+				rc = 1;
+			} else if (gate > 0 && p99 > gate) {
+				fprintf(stderr, "%s: p99 %ldus exceeds %ldus\n",
+					s->sc_name, p99, gate);
+				rc = 1;
+			}
+		}
+		if ((rate[backlight] = measure_devd(devd, ncycles, nsec)) < 0) {
+			fprintf(stderr, "devd listener failed\n");
+			rc = 1;
+		}
+	}
+
+	fprintf(out, "\n");
+	for (backlight = 0; backlight <= BENCH_BACKLIGHTS; backlight++)
+		fprintf(out, "devd listener with %d backlight(9): "
+			"%.0f events/s\n", backlight, rate[backlight]);
+
+	if (replay_ac_storms() < 0) {
+		fprintf(stderr, "ac storm replay failed\n");
+		rc = 1;
+	}
+
+	if (replay_light() < 0) {
+		fprintf(stderr, "light replay failed\n");
+		rc = 1;
+	}
+
+	if (stress() < 0) {
+		fprintf(stderr, "stress test failed\n");
+		rc = 1;
+	}
+
+#ifdef HAVE_SYS_BACKLIGHT_H
+	if (replay_calibration() < 0) {
+		fprintf(stderr, "calibration replay failed\n");
+		rc = 1;
+	}
+#endif
+
+	if (replay_idle() < 0) {
+		fprintf(stderr, "idle replay failed\n");
+		rc = 1;
+	}
+
+	for (i = 0; i < BENCH_BACKLIGHTS; i++)
+		if (snprintf(path, sizeof(path), "%s/backlight%d", bldir,
+			     i) < sizeof(path))
+			unlink(path);
+	rmdir(bldir);
+	unlink(conf);
+	unlink(cache);
+	rmdir(dir);
+	free(nsec);
+	fclose(out);
+
+	return rc;
+}
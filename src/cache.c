@@ -0,0 +1,237 @@
+/*-
+ * Copyright (c) 2026 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Cache of the values retrieved from the kernel.
+ *
+ * The cache file is placed under /var/run that is cleaned up on every
+ * boot, so that each entry is valid while the system is running and
+ * the fingerprint of the device doesn't change. The whole file is read
+ * at once, and only the updated entry is written back.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "asmctl.h"
+
+#define CACHE_MAGIC      0x41534d43  /* "ASMC" */
+#define CACHE_VERSION    1
+#define CACHE_NAMELEN    32
+#define CACHE_NENTRIES   16
+
+#define FNV_PRIME        0x100000001b3ULL
+
+struct cache_entry {
+	char ce_name[CACHE_NAMELEN];
+	uint64_t ce_fingerprint;
+	uint64_t ce_checksum;
+	int32_t ce_nvalues;
+	int32_t ce_values[CACHE_MAXVALUES];
+};
+
+struct cache_file {
+	uint32_t cf_magic;
+	uint32_t cf_version;
+	struct cache_entry cf_entries[CACHE_NENTRIES];
+};
+
+/* file name of the cache */
+char *cache_filename = "/var/run/asmctl.cache";
+
+/* file descriptor for the cache file */
+int cache_fd = -1;
+
+static struct cache_file cache;
+
+/* set 1 if the header is in the file */
+static int header_written = 0;
+
+/* the drivers run on the threads in a batch */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* utility: FNV-1a hash to make a fingerprint */
+uint64_t
+cache_fingerprint(uint64_t h, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+
+	while (len-- > 0) {
+		h ^= *p++;
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+static uint64_t
+entry_checksum(const struct cache_entry *e)
+{
+	uint64_t h = cache_fingerprint(CACHE_FP_INIT, e->ce_name,
+				       sizeof(e->ce_name));
+
+	h = cache_fingerprint(h, &e->ce_fingerprint,
+			      sizeof(e->ce_fingerprint));
+	return cache_fingerprint(h, e->ce_values,
+				 e->ce_nvalues * sizeof(e->ce_values[0]));
+}
+
+/*
+  Open and read the cache file, it must be done before entering
+  capability mode. An invalid cache file is just ignored.
+ */
+int
+open_cache_file()
+{
+	ssize_t len;
+
+	/* may fail, works without the cache file */
+	if ((cache_fd = TRACED(open(cache_filename, O_CREAT | O_RDWR,
+				    0600))) < 0)
+		return -1;
+
+	/* the entries after the last written one are not in the file */
+	len = TRACED(pread(cache_fd, &cache, sizeof(cache), 0));
+	if (len < (ssize_t)offsetof(struct cache_file, cf_entries) ||
+	    cache.cf_magic != CACHE_MAGIC ||
+	    cache.cf_version != CACHE_VERSION) {
+		memset(&cache, 0, sizeof(cache));
+		cache.cf_magic = CACHE_MAGIC;
+		cache.cf_version = CACHE_VERSION;
+		header_written = 0;
+	} else {
+		memset((char *)&cache + len, 0, sizeof(cache) - len);
+		header_written = 1;
+	}
+
+	return 0;
+}
+
+void
+close_cache_file()
+{
+	if (cache_fd != -1) {
+		TRACED(close(cache_fd));
+		cache_fd = -1;
+	}
+}
+
+static struct cache_entry *
+lookup_entry(const char *name)
+{
+	struct cache_entry *e;
+
+	ARRAY_FOREACH(e, cache.cf_entries)
+		if (strncmp(e->ce_name, name, CACHE_NAMELEN) == 0)
+			return e;
+	return NULL;
+}
+
+/*
+  Get the cached values of the name.
+  Returns the number of values, or -1 if not cached or the fingerprint
+  doesn't match.
+ */
+int
+cache_get(const char *name, uint64_t fp, int *values, int max)
+{
+	struct cache_entry *e;
+	int n = -1;
+
+	pthread_mutex_lock(&cache_lock);
+	if ((e = lookup_entry(name)) != NULL &&
+	    e->ce_fingerprint == fp &&
+	    e->ce_nvalues >= 0 && e->ce_nvalues <= MIN(max, CACHE_MAXVALUES) &&
+	    e->ce_checksum == entry_checksum(e)) {
+		n = e->ce_nvalues;
+		memcpy(values, e->ce_values, n * sizeof(int));
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	return n;
+}
+
+static int
+put_entry(const char *name, uint64_t fp, const int *values, int n)
+{
+	struct cache_entry *e;
+	off_t off;
+
+	if (n < 0 || n > CACHE_MAXVALUES || strlen(name) >= CACHE_NAMELEN)
+		return -1;
+
+	if ((e = lookup_entry(name)) == NULL && (e = lookup_entry("")) == NULL)
+		e = &cache.cf_entries[0];
+
+	memset(e, 0, sizeof(*e));
+	strlcpy(e->ce_name, name, CACHE_NAMELEN);
+	e->ce_fingerprint = fp;
+	e->ce_nvalues = n;
+	memcpy(e->ce_values, values, n * sizeof(int));
+	e->ce_checksum = entry_checksum(e);
+
+	if (cache_fd < 0)
+		return 0;
+
+	if (! header_written) {
+		if (TRACED(pwrite(cache_fd, &cache,
+				  offsetof(struct cache_file, cf_entries), 0)) < 0) {
+			fprintf(stderr, "can not write %s\n", cache_filename);
+			return -1;
+		}
+		header_written = 1;
+	}
+
+	off = (char *)e - (char *)&cache;
+	if (TRACED(pwrite(cache_fd, e, sizeof(*e), off)) < 0) {
+		fprintf(stderr, "can not write %s\n", cache_filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Store the values of the name and write the entry to the file. */
+int
+cache_put(const char *name, uint64_t fp, const int *values, int n)
+{
+	int rc;
+
+	pthread_mutex_lock(&cache_lock);
+	rc = put_entry(name, fp, values, n);
+	pthread_mutex_unlock(&cache_lock);
+
+	return rc;
+}
@@ -0,0 +1,943 @@
+/*-
+ * Copyright (c) 2015 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * Copyright (c) 2024 Joshua Rogers <joshua@joshua.hu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Driver contexts and the state file shared by asmctl(1) and asmctld(8).
+ *
+ * This code may require the following sysctl variables:
+ *
+ *  hw.acpi.video.lcd0.*	(acpi_video(4))
+ *  dev.asmc.<N>.light.control	(asmc(4))
+ *  hw.acpi.acline		(acpi(4))
+ *
+ * If backlight(9) devices are available, the following device files are
+ * used instead of 'hw.acpi.video.lcd0.*'.
+ *
+ *  /dev/backlight/backlight<N>
+ *
+ * A category may have several devices, such as the backlight(9)
+ * devices. Each of them is a unit that has its own driver context,
+ * all units of a category are controlled by the same driver.
+ *
+ * On Linux, the sysfs drivers are used (see sysfs.c).
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "asmctl.h"
+
+#define AC_POWER "hw.acpi.acline"
+
+/* set 1 if AC powered else 0 */
+int ac_powered = 0;
+
+/* the AC power status recorded in this time is used by up and down */
+long ac_cache_msec = AC_CACHE_MSEC;
+
+/* directory of the backlight(9) devices */
+char *backlight_dir = "/dev/backlight";
+
+/* available drivers. */
+static struct asmc_driver *asmc_drivers[] = {
+#ifdef __linux__
+    &sysfs_backlight_driver, &sysfs_kbd_driver,
+#endif
+#ifdef HAVE_SYS_BACKLIGHT_H
+    &backlight_driver,
+#endif
+    &acpi_video_driver, &acpi_keyboard_driver
+};
+
+#define UNITS(cat)							\
+	{(cat), 0}, {(cat), 1}, {(cat), 2}, {(cat), 3},			\
+	{(cat), 4}, {(cat), 5}, {(cat), 6}, {(cat), 7}
+
+/* driver contexts of the units of video & keyboard. */
+struct asmc_driver_context asmc_contexts[ASMC_NCONTEXTS] = {
+	UNITS(VIDEO), UNITS(KEYBOARD)
+};
+
+/* number of the units found by the probe, -1 if not probed yet */
+static int nunits[] = {
+	[VIDEO] = -1,
+	[KEYBOARD] = -1,
+};
+
+/* names of the probe cache entries */
+static const char *probe_names[] = {
+	[VIDEO] = "probe.video",
+	[KEYBOARD] = "probe.keyboard",
+};
+
+/*
+  available subcommands.
+  MUST be sorted by name.
+*/
+static struct driver_type {
+	char *name;
+	enum CATEGORY category;
+} type_table[] = {
+	{"kb", KEYBOARD},
+	{"kbd", KEYBOARD},
+	{"key", KEYBOARD},
+	{"keyboard", KEYBOARD},
+	{"lcd", VIDEO},
+	{"video", VIDEO},
+};
+
+/*
+  The probe cache is valid for the same drivers and the same sysfs
+  root.
+ */
+static uint64_t
+probe_fingerprint(void)
+{
+	struct asmc_driver **p;
+	uint64_t fp = CACHE_FP_INIT;
+
+	ARRAY_FOREACH(p, asmc_drivers)
+		fp = cache_fingerprint(fp, (*p)->name, strlen((*p)->name) + 1);
+	return cache_fingerprint(fp, sysfs_root, strlen(sysfs_root));
+}
+
+/* the context of the unit of the category */
+struct asmc_driver_context *
+asmc_context(enum CATEGORY cat, int unit)
+{
+	return &asmc_contexts[(cat == VIDEO ? 0 : ASMC_MAXUNITS) + unit];
+}
+
+/* allocate the context and initialize the driver for the unit. */
+static int
+probe_driver(struct asmc_driver *ad, struct asmc_driver_context *c)
+{
+	if ((c->context = calloc(1, ad->ctx_size)) == NULL) {
+		fprintf(stderr, "failed to allocate %zu bytes memory\n",
+			ad->ctx_size);
+		return -1;
+	}
+	c->driver = ad;
+	if (ASMC_INIT(c) < 0) {
+		free(c->context);
+		c->driver = NULL;
+		c->context = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/* clean up the driver context */
+static void cleanup_driver_context(struct asmc_driver_context *c)
+{
+	if (c->driver == NULL)
+		return;
+	ASMC_CLEANUP(c);
+	free(c->context);
+	c->driver = NULL;
+	c->context = NULL;
+}
+
+/* clean up all of the driver contexts, they are probed again. */
+static void
+cleanup_contexts(void)
+{
+	struct asmc_driver_context *c;
+
+	ARRAY_FOREACH(c, asmc_contexts)
+		cleanup_driver_context(c);
+	nunits[VIDEO] = nunits[KEYBOARD] = -1;
+}
+
+/* initialize the units following the first one, returns the number. */
+static int
+probe_units(struct asmc_driver *ad, enum CATEGORY cat)
+{
+	int n;
+
+	for (n = 1; n < ASMC_MAXUNITS; n++)
+		if ((ad->probe != NULL && ad->probe(n) < 0) ||
+		    probe_driver(ad, asmc_context(cat, n)) < 0)
+			break;
+	return n;
+}
+
+/*
+  lookup up an asmc driver of the category. initialize the first unit
+  of the first match and successfully initialized driver in
+  'asmc_drivers'. The driver and the number of the units found last
+  time are tried first, the others are probed only if it fails.
+ */
+static int
+lookup_driver(enum CATEGORY cat)
+{
+	struct asmc_driver_context *c = asmc_context(cat, 0);
+	struct asmc_driver **p;
+	uint64_t fp = probe_fingerprint();
+	int i, last[2] = {-1, 0};
+
+	if (cache_get(probe_names[cat], fp, last, 2) == 2 &&
+	    last[0] >= 0 && last[0] < nitems(asmc_drivers) &&
+	    last[1] > 0 && last[1] <= ASMC_MAXUNITS &&
+	    asmc_drivers[last[0]]->category == cat &&
+	    probe_driver(asmc_drivers[last[0]], c) == 0) {
+		nunits[cat] = last[1];
+		return 0;
+	}
+
+	ARRAY_FOREACH(p, asmc_drivers) {
+		i = p - asmc_drivers;
+		if ((*p)->category != cat || i == last[0] ||
+		    probe_driver(*p, c) < 0)
+			continue;
+		last[0] = i;
+		last[1] = nunits[cat] = probe_units(*p, cat);
+		cache_put(probe_names[cat], fp, last, 2);
+		return 0;
+	}
+	return -1;
+}
+
+/* initialize the driver of the context if it's not yet. */
+static int
+init_context(struct asmc_driver_context *c)
+{
+	struct asmc_driver_context *first = asmc_context(c->category, 0);
+	int last[2];
+
+	if (c->driver != NULL)
+		return 0;
+	if (probe_driver(first->driver, c) == 0)
+		return 0;
+
+	/* the device is gone, the rest of the units are not used */
+	nunits[c->category] = c->unit;
+	last[0] = -1;
+	last[1] = 0;
+	cache_put(probe_names[c->category], probe_fingerprint(), last, 2);
+	return -1;
+}
+
+/*
+  Initialize the units of the category, or only the 'unit' if it's not
+  -1. The driver is probed if it's not yet.
+ */
+int
+init_units(enum CATEGORY cat, int unit)
+{
+	int i;
+
+	if (nunits[cat] < 0 && lookup_driver(cat) < 0)
+		return -1;
+
+	if (unit >= nunits[cat])
+		return -1;
+	if (unit >= 0)
+		return init_context(asmc_context(cat, unit));
+
+	/* the units after a missing one are not used */
+	for (i = 0; i < nunits[cat]; i++)
+		if (init_context(asmc_context(cat, i)) < 0)
+			break;
+	return 0;
+}
+
+/* the name of the category in the state file and the output */
+const char *
+asmc_category_name(enum CATEGORY cat)
+{
+	return (cat == VIDEO) ? "video" : (cat == KEYBOARD) ? "keyboard" :
+		"none";
+}
+
+int
+asmc_driver_index(const struct asmc_driver *ad)
+{
+	int i;
+
+	for (i = 0; i < nitems(asmc_drivers); i++)
+		if (asmc_drivers[i] == ad)
+			return i;
+	return -1;
+}
+
+/*
+  Print the levels saved in the state file of the units of the category,
+  or all of the categories if 'cat' is NONE. If 'verify' is set, the
+  level of the hardware is read by the contexts initialized already.
+  The drivers are not used without 'verify'.
+ */
+int
+asmc_status(enum CATEGORY cat, int unit, int verify)
+{
+	static const enum CATEGORY all[] = {VIDEO, KEYBOARD};
+	const enum CATEGORY *p;
+	struct asmc_driver_context *c;
+	struct asmc_levels l;
+	int i, d, hw, rc = 0, n = 0;
+
+	/* the AC power status recorded last as up and down use it */
+	if (conf_get_recent_ac(LONG_MAX, &ac_powered) < 0)
+		ac_powered = conf_get_ac();
+
+	ARRAY_FOREACH(p, all) {
+		if (cat != NONE && cat != *p)
+			continue;
+		for (i = 0; i < ASMC_MAXUNITS; i++) {
+			if ((unit >= 0 && i != unit) ||
+			    conf_get_status(*p, i, &d, &l) < 0 ||
+			    d < 0 || d >= nitems(asmc_drivers))
+				continue;
+			if (n++ == 0)
+				output_text("ac: %s\n", (ac_powered < 0) ? "-" :
+					    ac_powered ? "on" : "off");
+			hw = -1;
+			c = asmc_context(*p, i);
+			if (verify && (c->driver != asmc_drivers[d] ||
+				       ASMC_READ(c, &hw) < 0)) {
+				fprintf(stderr, "%s:%d %s is not found\n",
+					asmc_category_name(*p), i,
+					asmc_drivers[d]->name);
+				rc = -1;
+			}
+			output_status(*p, i, asmc_drivers[d]->name, &l, hw);
+		}
+	}
+
+	if (n == 0) {
+		fprintf(stderr, "no level is saved\n");
+		return -1;
+	}
+	return rc;
+}
+
+/* initialize all units of video & keyboard backlight drivers. */
+int
+init_driver_context()
+{
+	if (init_units(KEYBOARD, -1) < 0)
+		return -1;
+	if (init_units(VIDEO, -1) < 0) {
+		cleanup_contexts();
+		return -1;
+	}
+	return 0;
+}
+
+/* utility: choose the brightness level on an acpi event */
+int
+choose_acpi_level(int eco, int full)
+{
+	return (ac_powered) ? (MAX(eco, full)) : (MIN(eco, full));
+}
+
+int
+get_ac_powered()
+{
+	char buf[128];
+	size_t buflen = sizeof(buf);
+
+	if (HW_SYSCTL(AC_POWER, buf, &buflen, NULL, 0) < 0) {
+#ifdef __linux__
+		/* Linux has the AC adapter in sysfs */
+		if (sysfs_get_ac_powered(&ac_powered) < 0)
+			return -1;
+#else
+		fprintf(stderr, "sysctl %s : %s\n", AC_POWER, strerror(errno));
+		return -1;
+#endif
+	} else
+		ac_powered = *((int *)buf);
+
+	/* up and down use it until it gets old */
+	conf_set_ac(ac_powered);
+	conf_count(STAT_AC_QUERIES, 1);
+
+	return 0;
+}
+
+/*
+  Get the AC power status for the batch. 'acpi' asks the kernel, the
+  others use the status recorded by the last query or the AC power
+  event unless it's older than 'ac_cache_msec'.
+ */
+int
+batch_ac_powered(const struct asmc_batch *b)
+{
+	int i, powered;
+
+	for (i = 0; i < b->ab_nops; i++)
+		if (b->ab_ops[i].bo_cmd.op == OP_ACPI)
+			return get_ac_powered();
+
+	if (conf_get_recent_ac(ac_cache_msec, &powered) < 0)
+		return get_ac_powered();
+
+	ac_powered = powered;
+	conf_count(STAT_AC_CACHED, 1);
+	return 0;
+}
+
+#ifdef USE_CAPSICUM
+
+/* Global channel to the sysctl caspter.*/
+cap_channel_t *ch_sysctl;
+
+int
+init_capsicum(void)
+{
+	struct asmc_driver_context *c;
+	cap_sysctl_limit_t *limits;
+	cap_channel_t *ch_casper;
+	cap_rights_t conf_fd_rights, cache_fd_rights;
+
+#ifdef HAVE_CAPSICUM_HELPERS_H
+	caph_cache_catpages();
+#else
+	catopen("libc", NL_CAT_LOCALE);
+#endif
+
+	/* Open a channel to casperd */
+	if ((ch_casper = TRACED(cap_init())) == NULL) {
+		fprintf(stderr, "cap_init() failed\n");
+		return -1;
+	}
+
+	/* open channel to casper sysctl */
+	if ((ch_sysctl = TRACED(cap_service_open(ch_casper,
+						  "system.sysctl"))) == NULL) {
+		fprintf(stderr, "cap_service_open(\"system.sysctl\") failed\n");
+		cap_close(ch_casper);
+		return -1;
+	}
+
+	/* limit sysctl names */
+	limits = cap_sysctl_limit_init(ch_sysctl);
+	hw_sysctl_limit(limits, AC_POWER, CAP_SYSCTL_READ);
+
+	/* set rights for the initialized drivers */
+	ARRAY_FOREACH(c, asmc_contexts)
+		if (c->driver != NULL)
+			ASMC_SET_RIGHTS(c, limits);
+	if (light_enabled)
+		light_cap_set_rights(limits);
+
+	if (TRACED(cap_sysctl_limit(limits)) < 0) {
+		cap_sysctl_limit_destroy(limits);
+		fprintf(stderr, "cap_sysctl_limit failed %s\n",
+			strerror(errno));
+		cap_close(ch_casper);
+		cap_close(ch_sysctl);
+		return -1;
+	}
+
+	cap_sysctl_limit_destroy(limits);
+
+	/* the MIBs are resolved for the limits before it */
+	if (TRACED(cap_enter()) < 0) {
+		fprintf(stderr, "capability is not supported\n");
+		cap_close(ch_casper);
+		return -1;
+	}
+
+	/* the state file is already mapped, and locked to coalesce steps */
+	cap_rights_init(&conf_fd_rights, CAP_MMAP_RW, CAP_FLOCK);
+	if (TRACED(cap_rights_limit(conf_fd, &conf_fd_rights)) < 0) {
+		fprintf(stderr, "cap_rights_limit() failed\n");
+		cap_close(ch_casper);
+		return -1;
+	}
+
+	/* the cache file is read and written by pread/pwrite */
+	cap_rights_init(&cache_fd_rights, CAP_PREAD | CAP_PWRITE);
+	if (cache_fd != -1 &&
+	    TRACED(cap_rights_limit(cache_fd, &cache_fd_rights)) < 0) {
+		fprintf(stderr, "cap_rights_limit() failed\n");
+		cap_close(ch_casper);
+		return -1;
+	}
+
+	/* close connection to casper */
+	cap_close(ch_casper);
+
+	return 0;
+}
+#endif
+
+void
+cleanup()
+{
+	cleanup_contexts();
+	close_conf_file();
+	close_cache_file();
+}
+
+static int
+type_compare(const void *a, const void *b)
+{
+	const char *s = a;
+	const struct driver_type *t = b;
+	return strcmp(s, t->name);
+}
+
+/*
+  lookup the category by the subcommand name, such as 'video' or
+  'video:1' for the second unit. The unit is set -1 if it's omitted.
+ */
+int
+lookup_category(const char *name, enum CATEGORY *cat, int *unit)
+{
+	char buf[16], *p, *q;
+	struct driver_type *type;
+	long u = -1;
+
+	strlcpy(buf, name, sizeof(buf));
+	if ((p = strchr(buf, ':')) != NULL) {
+		*p++ = '\0';
+		u = strtol(p, &q, 10);
+		if (q == p || *q != '\0' || u < 0 || u >= ASMC_MAXUNITS)
+			return -1;
+	}
+
+	type = bsearch(buf, type_table, nitems(type_table),
+		      sizeof(type_table[0]), type_compare);
+	if (type == NULL)
+		return -1;
+
+	*cat = type->category;
+	*unit = u;
+	return 0;
+}
+
+/* utility: parse a level with an optional '%'. */
+static int
+parse_level(const char *str, int *val, int *percent)
+{
+	char *p;
+	long v;
+
+	v = strtol(str, &p, 10);
+	if (p == str || v < 0 || v > INT_MAX)
+		return -1;
+	if ((*percent = (*p == '%')))
+		p++;
+	if (*p != '\0')
+		return -1;
+	*val = v;
+	return 0;
+}
+
+/* parse the milliseconds of an option, returns -1 if invalid */
+int
+parse_msec(const char *str, long *msec)
+{
+	char *p;
+	long v;
+
+	v = strtol(str, &p, 10);
+	if (p == str || *p != '\0' || v < 0 || v > INT_MAX) {
+		fprintf(stderr, "invalid milliseconds: %s\n", str);
+		return -1;
+	}
+	*msec = v;
+	return 0;
+}
+
+static int
+is_operation(const char *name, const char *op)
+{
+	return strcmp(name, op) == 0 || (name[0] == op[0] && name[1] == '\0');
+}
+
+/*
+  Parse an operation and its argument, such as 'up', 'up 3' or
+  'set 50%'. Returns the number of the consumed arguments,
+  or -1 if it's invalid.
+ */
+int
+parse_command(int argc, char *argv[], struct asmc_command *cmd)
+{
+	int percent;
+
+	if (argc < 1)
+		return -1;
+
+	cmd->arg = 1;
+	cmd->percent = 0;
+
+	if (is_operation(argv[0], "acpi")) {
+		cmd->op = OP_ACPI;
+		return 1;
+	}
+
+	if (is_operation(argv[0], "up") || is_operation(argv[0], "down")) {
+		cmd->op = (argv[0][0] == 'u') ? OP_UP : OP_DOWN;
+		/* the number of steps is optional */
+		if (argc > 1 && parse_level(argv[1], &cmd->arg, &percent) == 0 &&
+		    ! percent)
+			return 2;
+		cmd->arg = 1;
+		return 1;
+	}
+
+	if (is_operation(argv[0], "calibrate")) {
+		cmd->op = OP_CALIBRATE;
+		return 1;
+	}
+
+	if (is_operation(argv[0], "set")) {
+		cmd->op = OP_SET;
+		if (argc > 1 &&
+		    parse_level(argv[1], &cmd->arg, &cmd->percent) == 0)
+			return 2;
+	}
+
+	return -1;
+}
+
+/* apply the operation to the driver context. */
+int
+asmc_operate(struct asmc_driver_context *ctx, const struct asmc_command *cmd)
+{
+	struct asmc_levels old, new;
+	int rc;
+
+	if (output_mode == OUTPUT_JSON)
+		ASMC_LEVELS(ctx, &old);
+
+	switch (cmd->op) {
+	case OP_ACPI:
+		rc = ASMC_ACPI(ctx);
+		break;
+	case OP_UP:
+		rc = ASMC_UP(ctx, cmd->arg);
+		break;
+	case OP_DOWN:
+		rc = ASMC_DOWN(ctx, cmd->arg);
+		break;
+	case OP_SET:
+		rc = ASMC_SET(ctx, cmd->arg,
+			      cmd->percent ? ASMC_SET_PERCENT : 0);
+		break;
+	case OP_CALIBRATE:
+		if (ctx->driver->calibrate == NULL) {
+			fprintf(stderr, "%s can not be calibrated\n",
+				ctx->driver->name);
+			return -1;
+		}
+		rc = ASMC_CALIBRATE(ctx);
+		break;
+	default:
+		return -1;
+	}
+
+	if (rc == 0 && output_mode == OUTPUT_JSON) {
+		ASMC_LEVELS(ctx, &new);
+		output_levels(ctx, &old, &new);
+	}
+	return rc;
+}
+
+/*
+  Parse the pairs of a category and an operation, such as
+  'video up key down' or 'all acpi'. The category 'all' is expanded
+  to all of the devices.
+ */
+int
+parse_batch(int argc, char *argv[], struct asmc_batch *b)
+{
+	static const enum CATEGORY all[] = {VIDEO, KEYBOARD};
+	const enum CATEGORY *p;
+	enum CATEGORY cat = NONE;
+	struct asmc_command cmd;
+	int n, unit = -1;
+
+	b->ab_nops = 0;
+	while (argc > 0) {
+		if (strcmp(argv[0], "all") == 0)
+			cat = NONE;
+		else if (lookup_category(argv[0], &cat, &unit) < 0)
+			return -1;
+		if ((n = parse_command(argc - 1, &argv[1], &cmd)) < 0)
+			return -1;
+		argc -= n + 1;
+		argv += n + 1;
+
+		ARRAY_FOREACH(p, all) {
+			if (cat != NONE && cat != *p)
+				continue;
+			if (b->ab_nops == BATCH_MAXOPS)
+				return -1;
+			b->ab_ops[b->ab_nops].bo_cat = *p;
+			b->ab_ops[b->ab_nops].bo_unit = (cat != NONE) ? unit : -1;
+			b->ab_ops[b->ab_nops].bo_cmd = cmd;
+			b->ab_nops++;
+		}
+	}
+
+	return (b->ab_nops > 0) ? 0 : -1;
+}
+
+/* initialize the drivers of the units used in the batch. */
+int
+init_batch_context(const struct asmc_batch *b)
+{
+	int i;
+
+	for (i = 0; i < b->ab_nops; i++)
+		if (init_units(b->ab_ops[i].bo_cat, b->ab_ops[i].bo_unit) < 0)
+			return -1;
+	return 0;
+}
+
+/* the categories used in the batch, for conf_lock(). */
+unsigned
+batch_categories(const struct asmc_batch *b)
+{
+	unsigned cats = 0;
+	int i;
+
+	for (i = 0; i < b->ab_nops; i++)
+		cats |= CATEGORY_BIT(b->ab_ops[i].bo_cat);
+	return cats;
+}
+
+/* the operation is applied to the unit */
+static int
+is_target(const struct asmc_batch_op *op, const struct asmc_driver_context *c)
+{
+	return c->driver != NULL && op->bo_cat == c->category &&
+		(op->bo_unit < 0 || op->bo_unit == c->unit);
+}
+
+struct batch_worker {
+	const struct asmc_batch *bw_batch;
+	struct asmc_driver_context *bw_ctx;
+	pthread_t bw_thread;
+	int bw_started;
+	int bw_rc;
+};
+
+/* apply the operations of the device in order */
+static void *
+run_worker(void *arg)
+{
+	struct batch_worker *w = arg;
+	const struct asmc_batch *b = w->bw_batch;
+	int i;
+
+	for (i = 0; i < b->ab_nops; i++)
+		if (is_target(&b->ab_ops[i], w->bw_ctx) &&
+		    asmc_operate(w->bw_ctx, &b->ab_ops[i].bo_cmd) < 0)
+			w->bw_rc = -1;
+	return NULL;
+}
+
+/*
+  Apply the operations of the batch. If 'concurrent' is not 0, each
+  unit is operated on its own thread, the operations of a unit are
+  applied in the given order.
+ */
+int
+asmc_operate_batch(const struct asmc_batch *b, int concurrent)
+{
+	struct batch_worker workers[ASMC_NCONTEXTS], *w;
+	struct asmc_driver_context *c;
+	int i, j, n = 0, rc = 0;
+
+	if (! concurrent) {
+		for (i = 0; i < b->ab_nops; i++)
+			ARRAY_FOREACH(c, asmc_contexts) {
+				if (! is_target(&b->ab_ops[i], c))
+					continue;
+				if (asmc_operate(c, &b->ab_ops[i].bo_cmd) < 0)
+					rc = -1;
+				n++;
+			}
+		/* a unit selected by the command is not found */
+		return (n > 0) ? rc : -1;
+	}
+
+	/* the units in the batch */
+	ARRAY_FOREACH(c, asmc_contexts) {
+		for (j = 0; j < b->ab_nops; j++)
+			if (is_target(&b->ab_ops[j], c))
+				break;
+		if (j == b->ab_nops)
+			continue;
+		w = &workers[n++];
+		memset(w, 0, sizeof(*w));
+		w->bw_batch = b;
+		w->bw_ctx = c;
+	}
+
+	/* a unit selected by the command is not found */
+	if (n == 0)
+		return -1;
+
+	/* the first device runs on this thread */
+	for (i = 1; i < n; i++)
+		workers[i].bw_started = (pthread_create(&workers[i].bw_thread,
+							NULL, run_worker,
+							&workers[i]) == 0);
+	for (i = 0; i < n; i++)
+		if (i == 0 || ! workers[i].bw_started)
+			run_worker(&workers[i]);
+	for (i = 1; i < n; i++)
+		if (workers[i].bw_started)
+			pthread_join(workers[i].bw_thread, NULL);
+
+	for (i = 0; i < n; i++)
+		if (workers[i].bw_rc < 0)
+			rc = -1;
+	return rc;
+}
+
+/*
+  Read the commands from the file, '-' is the standard input.
+  The words are stored in 'argv' that points to 'buf'.
+  Returns the number of the words, or -1 on error.
+ */
+int
+read_script(const char *path, char *buf, size_t len, char *argv[], int max)
+{
+	FILE *fp;
+	size_t n;
+	char *p, *q, *line;
+	int argc = 0;
+
+	if ((fp = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r")) == NULL) {
+		fprintf(stderr, "can not open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	n = fread(buf, 1, len - 1, fp);
+	if (ferror(fp) || ! feof(fp)) {
+		fprintf(stderr, "can not read %s%s\n", path,
+			ferror(fp) ? "" : ": too long");
+		if (fp != stdin)
+			fclose(fp);
+		return -1;
+	}
+	if (fp != stdin)
+		fclose(fp);
+	buf[n] = '\0';
+
+	p = buf;
+	while ((line = strsep(&p, "\n")) != NULL) {
+		/* comments */
+		if ((q = strchr(line, '#')) != NULL)
+			*q = '\0';
+		while ((q = strsep(&line, " \t")) != NULL) {
+			if (*q == '\0')
+				continue;
+			if (argc == max) {
+				fprintf(stderr, "too many commands in %s\n",
+					path);
+				return -1;
+			}
+			argv[argc++] = q;
+		}
+	}
+
+	return argc;
+}
+
+/*
+  Key repeats run many processes of 'up' or 'down' at the same time.
+  The steps are added to the pending counter in the state file and
+  only the leader applies them.
+  Returns 1 if this process is the leader, 0 if the steps are passed to
+  the leader, or -1 if the batch is not coalesced.
+ */
+int
+coalesce_batch(const struct asmc_batch *b)
+{
+	const struct asmc_batch_op *op = &b->ab_ops[0];
+	enum CATEGORY cat = op->bo_cat;
+
+	/* the steps are applied to all of the units */
+	if (b->ab_nops != 1 || op->bo_unit >= 0 ||
+	    (op->bo_cmd.op != OP_UP && op->bo_cmd.op != OP_DOWN))
+		return -1;
+
+	conf_pending_add(cat, (op->bo_cmd.op == OP_UP) ? op->bo_cmd.arg :
+			 -op->bo_cmd.arg);
+	if (conf_lead(cat))
+		return 1;
+
+	conf_count(STAT_STEPS_COALESCED, op->bo_cmd.arg);
+	return 0;
+}
+
+/*
+  Apply the pending steps as the leader until no step is left.
+  The levels are loaded after locking them, and the state file is
+  stored every time before leaving the leader.
+ */
+int
+asmc_lead(enum CATEGORY cat)
+{
+	struct asmc_batch b = {.ab_nops = 1};
+	struct asmc_batch_op *op = &b.ab_ops[0];
+	int n, rc = 0;
+
+	op->bo_cat = cat;
+	op->bo_unit = -1;
+	op->bo_cmd.percent = 0;
+
+	do {
+		/* another process may have stored the levels */
+		if (conf_lock(CATEGORY_BIT(cat)) < 0 ||
+		    get_saved_levels() < 0) {
+			conf_unlock(CATEGORY_BIT(cat));
+			conf_unlead(cat);
+			return -1;
+		}
+		while ((n = conf_pending_take(cat)) != 0) {
+			op->bo_cmd.op = (n > 0) ? OP_UP : OP_DOWN;
+			op->bo_cmd.arg = abs(n);
+			if (asmc_operate_batch(&b, 1) < 0)
+				rc = -1;
+		}
+		store_conf_file();
+		conf_unlock(CATEGORY_BIT(cat));
+		conf_unlead(cat);
+		/* steps added after the last take */
+	} while (conf_pending_get(cat) != 0 && conf_lead(cat));
+
+	return rc;
+}
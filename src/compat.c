@@ -0,0 +1,159 @@
+/*-
+ * Copyright (c) 2026 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Functions of FreeBSD that the other systems may not have.
+ *
+ * Only the numbers of nvlist(9) are used for the saved levels, so the
+ * nvlist here is a simple list of the names and the numbers. The
+ * configure script chooses libnv if it is installed.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "asmctl.h"
+
+#ifndef HAVE_SYS_NV_H
+struct nvpair {
+	char *np_name;
+	uint64_t np_value;
+	TAILQ_ENTRY(nvpair) np_next;
+};
+
+struct nvlist {
+	TAILQ_HEAD(, nvpair) nl_head;
+};
+
+static struct nvpair *
+nvlist_find(const nvlist_t *nl, const char *name)
+{
+	struct nvpair *np;
+
+	TAILQ_FOREACH(np, &nl->nl_head, np_next)
+		if (strcmp(np->np_name, name) == 0)
+			return np;
+	return NULL;
+}
+
+nvlist_t *
+nvlist_create(int flags)
+{
+	nvlist_t *nl;
+
+	if ((nl = malloc(sizeof(*nl))) == NULL)
+		return NULL;
+	TAILQ_INIT(&nl->nl_head);
+	return nl;
+}
+
+void
+nvlist_destroy(nvlist_t *nl)
+{
+	struct nvpair *np;
+
+	if (nl == NULL)
+		return;
+	while ((np = TAILQ_FIRST(&nl->nl_head)) != NULL) {
+		TAILQ_REMOVE(&nl->nl_head, np, np_next);
+		free(np->np_name);
+		free(np);
+	}
+	free(nl);
+}
+
+bool
+nvlist_exists_number(const nvlist_t *nl, const char *name)
+{
+	return nvlist_find(nl, name) != NULL;
+}
+
+uint64_t
+nvlist_get_number(const nvlist_t *nl, const char *name)
+{
+	struct nvpair *np = nvlist_find(nl, name);
+
+	return (np != NULL) ? np->np_value : 0;
+}
+
+/* the same name is not added twice as libnv */
+void
+nvlist_add_number(nvlist_t *nl, const char *name, uint64_t value)
+{
+	struct nvpair *np;
+
+	if (nvlist_find(nl, name) != NULL ||
+	    (np = malloc(sizeof(*np))) == NULL)
+		return;
+	if ((np->np_name = strdup(name)) == NULL) {
+		free(np);
+		return;
+	}
+	np->np_value = value;
+	TAILQ_INSERT_TAIL(&nl->nl_head, np, np_next);
+}
+
+const char *
+nvlist_next(const nvlist_t *nl, int *type, void **cookie)
+{
+	struct nvpair *np;
+
+	np = (*cookie == NULL) ? TAILQ_FIRST(&nl->nl_head) :
+		TAILQ_NEXT((struct nvpair *)*cookie, np_next);
+	if (np == NULL)
+		return NULL;
+	*type = NV_TYPE_NUMBER;
+	*cookie = np;
+	return np->np_name;
+}
+#endif
+
+#ifndef HAVE_STRLCPY
+size_t
+strlcpy(char *dst, const char *src, size_t size)
+{
+	size_t len = strlen(src);
+
+	if (size > 0) {
+		size = MIN(len, size - 1);
+		memcpy(dst, src, size);
+		dst[size] = '\0';
+	}
+	return len;
+}
+
+size_t
+strlcat(char *dst, const char *src, size_t size)
+{
+	size_t len = strnlen(dst, size);
+
+	if (len == size)
+		return len + strlen(src);
+	return len + strlcpy(dst + len, src, size - len);
+}
+#endif
@@ -0,0 +1,844 @@
+/*-
+ * Copyright (c) 2026 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * State file to save the backlight levels.
+ *
+ * The state file has a fixed layout and is mapped into memory. It has
+ * two slots of the levels with a generation number. A new state is
+ * written to the older slot and its generation number is increased
+ * at last, so that the newer slot is always left valid even if the
+ * writer crashes.
+ *
+ * An old state file in sysctl.conf(5) format is converted on opening.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "asmctl.h"
+
+#define CONF_MAGIC      0x41534d53  /* "ASMS" */
+#define CONF_VERSION    1
+#define CONF_NAMELEN    48
+#define CONF_NENTRIES   64
+#define CONF_NSTATS     32
+#define CONF_NPENDING   4
+#define CONF_TEXTSIZE   4096  /* of the file by the older version */
+
+/* records of the levels for 'asmctl status', by category and unit */
+#define CONF_STATUS_PREFIX  "status."
+#define CONF_STATUS     CONF_STATUS_PREFIX "%s.%d"
+#define CONF_STATUS_AC  CONF_STATUS_PREFIX "ac"
+/* a record packs the index of the driver and 7 bits of each level */
+#define STATUS_SHIFT    7
+#define STATUS_MASK     0x7f
+#define STATUS_UNKNOWN  STATUS_MASK
+
+/*
+  The bytes after the end of the file are locked by fcntl(2) and never
+  written. The byte of NONE is locked while writing the slots or
+  creating the file, and the byte of each category is locked from
+  loading the levels of the category to storing them.
+ */
+#define CONF_LOCK_OFFSET(cat)  ((off_t)sizeof(struct conf_file) + (cat))
+
+struct conf_entry {
+	char ce_name[CONF_NAMELEN];
+	int64_t ce_value;
+};
+
+struct conf_slot {
+	uint64_t cs_generation;
+	uint64_t cs_checksum;
+	uint32_t cs_nentries;
+	uint32_t cs_reserved;
+	struct conf_entry cs_entries[CONF_NENTRIES];
+};
+
+/*
+  The statistics and the pending steps are updated in place by any
+  process. The fields added at the end are zero filled when an older
+  file is extended.
+ */
+struct conf_file {
+	uint32_t cf_magic;
+	uint32_t cf_version;
+	struct conf_slot cf_slots[2];
+	_Atomic uint64_t cf_stats[CONF_NSTATS];
+	_Atomic int64_t cf_pending[CONF_NPENDING];  /* by enum CATEGORY */
+	_Atomic int64_t cf_ac;  /* msec << 1 | AC power, 0 if unknown */
+};
+
+/* names of the statistics, in the order of enum STATISTIC */
+static const char *stat_names[] = {
+	"hw_writes",
+	"hw_writes_skipped",
+	"state_writes",
+	"state_writes_skipped",
+	"steps_coalesced",
+	"light_samples",
+	"light_writes",
+	"ac_events",
+	"ac_events_suppressed",
+	"ac_queries",
+	"ac_cached",
+	"idle_input_wakeups",
+	"idle_timer_wakeups",
+	"idle_dims",
+};
+
+/* file name to save state */
+char *conf_filename = "/var/lib/asmctl.conf";
+
+/* file descriptor for the state file */
+int conf_fd = -1;
+
+/* mapped state file */
+static struct conf_file *conf_map = MAP_FAILED;
+
+/* set 1 if any level is changed since loaded, by any thread */
+static atomic_int conf_dirty = 0;
+
+static uint64_t
+slot_checksum(const struct conf_slot *s)
+{
+	uint64_t h;
+
+	h = cache_fingerprint(CACHE_FP_INIT, &s->cs_generation,
+			      sizeof(s->cs_generation));
+	h = cache_fingerprint(h, &s->cs_nentries, sizeof(s->cs_nentries));
+	return cache_fingerprint(h, s->cs_entries,
+				 MIN(s->cs_nentries, CONF_NENTRIES) *
+				 sizeof(s->cs_entries[0]));
+}
+
+static int
+slot_is_valid(const struct conf_slot *s)
+{
+	return s->cs_generation != 0 && s->cs_nentries <= CONF_NENTRIES &&
+		s->cs_checksum == slot_checksum(s);
+}
+
+/* returns the valid slot of the newer generation or NULL. */
+static const struct conf_slot *
+active_slot(const struct conf_file *cf)
+{
+	const struct conf_slot *s0 = &cf->cf_slots[0], *s1 = &cf->cf_slots[1];
+
+	if (! slot_is_valid(s0))
+		return slot_is_valid(s1) ? s1 : NULL;
+	if (! slot_is_valid(s1))
+		return s0;
+	return (s0->cs_generation > s1->cs_generation) ? s0 : s1;
+}
+
+/* write the levels to the older slot and make it active. */
+static int
+write_slot(struct conf_file *cf, nvlist_t *nl)
+{
+	const struct conf_slot *active = active_slot(cf);
+	struct conf_slot *s;
+	const char *name;
+	uint64_t generation;
+	uint32_t n = 0;
+	void *cookie;
+	int type;
+
+	if (active == &cf->cf_slots[0]) {
+		s = &cf->cf_slots[1];
+		generation = active->cs_generation + 1;
+	} else {
+		s = &cf->cf_slots[0];
+		generation = (active == NULL) ? 1 : active->cs_generation + 1;
+	}
+
+	/* invalidate the slot before updating */
+	s->cs_generation = 0;
+	atomic_thread_fence(memory_order_release);
+
+	cookie = NULL;
+	while ((name = nvlist_next(nl, &type, &cookie)) != NULL) {
+		if (type != NV_TYPE_NUMBER)
+			continue;
+		if (n == CONF_NENTRIES || strlen(name) >= CONF_NAMELEN) {
+			fprintf(stderr, "can not save %s\n", name);
+			continue;
+		}
+		memset(s->cs_entries[n].ce_name, 0, CONF_NAMELEN);
+		strlcpy(s->cs_entries[n].ce_name, name, CONF_NAMELEN);
+		s->cs_entries[n].ce_value = (int64_t)nvlist_get_number(nl, name);
+		n++;
+	}
+	s->cs_nentries = n;
+
+	/* the generation is the last to write */
+	s->cs_checksum = 0;
+	atomic_thread_fence(memory_order_release);
+	s->cs_generation = generation;
+	s->cs_checksum = slot_checksum(s);
+
+	return 0;
+}
+
+/* read the active slot to the nvlist */
+static int
+read_slot(const struct conf_file *cf, nvlist_t *nl)
+{
+	const struct conf_slot *s;
+	uint32_t i;
+
+	if ((s = active_slot(cf)) == NULL)
+		return -1;
+
+	for (i = 0; i < s->cs_nentries; i++)
+		if (s->cs_entries[i].ce_name[CONF_NAMELEN - 1] == '\0' &&
+		    ! nvlist_exists_number(nl, s->cs_entries[i].ce_name))
+			nvlist_add_number(nl, s->cs_entries[i].ce_name,
+					  s->cs_entries[i].ce_value);
+	return 0;
+}
+
+/* read the old state file in sysctl.conf(5) format */
+static int
+read_text_conf(int fd, nvlist_t *nl)
+{
+	char buf[CONF_TEXTSIZE];
+	char name[80];
+	char *line, *next, *p;
+	ssize_t size;
+	int value, len;
+
+	/* not by stdio, closing a dup(2) of the file releases the lock */
+	if ((size = TRACED(pread(fd, buf, sizeof(buf) - 1, 0))) < 0) {
+		fprintf(stderr, "can not read %s\n", conf_filename);
+		return -1;
+	}
+	buf[size] = '\0';
+
+	for (next = buf; (line = strsep(&next, "\n")) != NULL;) {
+		if (line[0] == '#')
+			continue;
+		p = strchr(line, '=');
+		if (p == NULL)
+			continue;
+		len = p - line;
+		len = (len < sizeof(name) - 1) ? len : sizeof(name) - 1;
+		strncpy(name, line, len);
+		name[len] = '\0';
+		value = strtol(p + 1, &p, 10);
+		/* the last line must end with a new line */
+		if (*p != '\0' || next == NULL)
+			continue;
+		if (! nvlist_exists_number(nl, name))
+			nvlist_add_number(nl, name, value);
+	}
+
+	return 0;
+}
+
+static int
+lock_range(off_t start, off_t len, short type, int cmd)
+{
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = start;
+	fl.l_len = len;
+
+	return TRACED(fcntl(conf_fd, cmd, &fl));
+}
+
+/*
+  Write a new state file of the levels, and replace the file by
+  rename(2) so that the old one is left on failure.
+ */
+static int
+create_conf_file(nvlist_t *nl)
+{
+	char path[PATH_MAX];
+	struct conf_file *cf;
+	int fd;
+
+	if (snprintf(path, sizeof(path), "%s.new", conf_filename) >=
+	    sizeof(path))
+		return -1;
+
+	if ((cf = calloc(1, sizeof(*cf))) == NULL) {
+		fprintf(stderr, "failed to allocate %zu bytes memory\n",
+			sizeof(*cf));
+		return -1;
+	}
+	cf->cf_magic = CONF_MAGIC;
+	cf->cf_version = CONF_VERSION;
+	write_slot(cf, nl);
+
+	if ((fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0600)) < 0) {
+		fprintf(stderr, "can not open %s\n", path);
+		free(cf);
+		return -1;
+	}
+	if (write(fd, cf, sizeof(*cf)) != sizeof(*cf) || fsync(fd) < 0 ||
+	    rename(path, conf_filename) < 0) {
+		fprintf(stderr, "can not write %s\n", conf_filename);
+		close(fd);
+		unlink(path);
+		free(cf);
+		return -1;
+	}
+
+	close(fd);
+	free(cf);
+	return 0;
+}
+
+/*
+  Open and map the state file, it must be done before entering
+  capability mode. The file is created or converted if it's not in
+  the binary format.
+ */
+int
+open_conf_file()
+{
+	struct conf_file hdr;
+	struct stat st, path_st;
+	nvlist_t *nl;
+	ssize_t len;
+
+again:
+	if ((conf_fd = TRACED(open(conf_filename, O_CREAT | O_RDWR,
+				   0600))) < 0) {
+		fprintf(stderr, "can not open %s\n", conf_filename);
+		return -1;
+	}
+
+	len = TRACED(pread(conf_fd, &hdr, offsetof(struct conf_file, cf_stats),
+			   0));
+	/* the levels of another version are not overwritten */
+	if (len == offsetof(struct conf_file, cf_stats) &&
+	    hdr.cf_magic == CONF_MAGIC && hdr.cf_version != CONF_VERSION) {
+		fprintf(stderr, "%s is version %u, not supported\n",
+			conf_filename, hdr.cf_version);
+		goto err;
+	}
+	if (len != offsetof(struct conf_file, cf_stats) ||
+	    hdr.cf_magic != CONF_MAGIC) {
+		/* the file is created or converted by one process at a time */
+		if (lock_range(CONF_LOCK_OFFSET(NONE), 1, F_WRLCK,
+			       F_SETLKW) < 0) {
+			fprintf(stderr, "can not lock %s: %s\n",
+				conf_filename, strerror(errno));
+			goto err;
+		}
+		/* replaced by another process while waiting for the lock */
+		if (TRACED(fstat(conf_fd, &st)) == 0 &&
+		    TRACED(stat(conf_filename, &path_st)) == 0 &&
+		    (st.st_dev != path_st.st_dev ||
+		     st.st_ino != path_st.st_ino)) {
+			TRACED(close(conf_fd));
+			goto again;
+		}
+		if ((nl = nvlist_create(0)) == NULL) {
+			fprintf(stderr, "nvlist_create: %s\n",
+				strerror(errno));
+			goto err;
+		}
+		/* the file is written by the older version of asmctl */
+		if ((hdr.cf_magic != CONF_MAGIC &&
+		     read_text_conf(conf_fd, nl) < 0) ||
+		    create_conf_file(nl) < 0) {
+			nvlist_destroy(nl);
+			goto err;
+		}
+		nvlist_destroy(nl);
+
+		/* the lock is released as well */
+		TRACED(close(conf_fd));
+		if ((conf_fd = TRACED(open(conf_filename, O_RDWR))) < 0) {
+			fprintf(stderr, "can not open %s\n", conf_filename);
+			return -1;
+		}
+	}
+
+	/* extend the file written by the older version */
+	if (TRACED(fstat(conf_fd, &st)) < 0 ||
+	    (st.st_size < sizeof(*conf_map) &&
+	     TRACED(ftruncate(conf_fd, sizeof(*conf_map))) < 0)) {
+		fprintf(stderr, "can not extend %s: %s\n", conf_filename,
+			strerror(errno));
+		goto err;
+	}
+
+	conf_map = TRACED(mmap(NULL, sizeof(*conf_map),
+			       PROT_READ | PROT_WRITE, MAP_SHARED, conf_fd, 0));
+	if (conf_map == MAP_FAILED) {
+		fprintf(stderr, "mmap %s: %s\n", conf_filename,
+			strerror(errno));
+		goto err;
+	}
+
+	return 0;
+err:
+	TRACED(close(conf_fd));
+	conf_fd = -1;
+	return -1;
+}
+
+void
+close_conf_file()
+{
+	if (conf_map != MAP_FAILED) {
+		TRACED(munmap(conf_map, sizeof(*conf_map)));
+		conf_map = MAP_FAILED;
+	}
+	if (conf_fd != -1) {
+		TRACED(close(conf_fd));
+		conf_fd = -1;
+	}
+}
+
+static int
+pack_level(int val)
+{
+	return (val < 0 || val > LEVEL_MAX) ? STATUS_UNKNOWN : val;
+}
+
+static int
+unpack_level(int64_t v, int n)
+{
+	v = (v >> (STATUS_SHIFT * n)) & STATUS_MASK;
+	return (v == STATUS_UNKNOWN) ? -1 : v;
+}
+
+/* the levels of the context are read by 'asmctl status' */
+static void
+save_status(const struct asmc_driver_context *c, nvlist_t *nl)
+{
+	struct asmc_levels l;
+	char name[CONF_NAMELEN];
+
+	if (ASMC_LEVELS(c, &l) < 0)
+		return;
+	snprintf(name, sizeof(name), CONF_STATUS,
+		 asmc_category_name(c->category), c->unit);
+	nvlist_add_number(nl, name,
+			  (int64_t)asmc_driver_index(c->driver) <<
+			  (STATUS_SHIFT * 3) |
+			  pack_level(l.al_current) << (STATUS_SHIFT * 2) |
+			  pack_level(l.al_economy) << STATUS_SHIFT |
+			  pack_level(l.al_fullpower));
+}
+
+/*
+  Store backlight levels to the state file.
+  Nothing is written if no level is changed.
+ */
+int
+store_conf_file()
+{
+	struct asmc_driver_context *c;
+	nvlist_t *nl;
+
+	if (conf_map == MAP_FAILED)
+		return -1;
+
+	if (! conf_dirty) {
+		conf_count(STAT_STATE_WRITES_SKIPPED, 1);
+		return 0;
+	}
+
+	if ((nl = nvlist_create(0)) == NULL) {
+		fprintf(stderr, "nvlist_create: %s\n", strerror(errno));
+		return -1;
+	}
+	ARRAY_FOREACH(c, asmc_contexts)
+		if (c->driver != NULL) {
+			ASMC_SAVE(c, nl);
+			save_status(c, nl);
+		}
+	nvlist_add_number(nl, CONF_STATUS_AC, ac_powered);
+
+	/* the other categories may be stored by another process */
+	if (lock_range(CONF_LOCK_OFFSET(NONE), 1, F_WRLCK, F_SETLKW) < 0) {
+		fprintf(stderr, "can not lock %s: %s\n", conf_filename,
+			strerror(errno));
+		nvlist_destroy(nl);
+		return -1;
+	}
+	/* keep the levels of the drivers that are not initialized */
+	read_slot(conf_map, nl);
+
+	write_slot(conf_map, nl);
+	lock_range(CONF_LOCK_OFFSET(NONE), 1, F_UNLCK, F_SETLK);
+	conf_dirty = 0;
+	conf_count(STAT_STATE_WRITES, 1);
+
+	nvlist_destroy(nl);
+	return 0;
+}
+
+/* utility: set the level and mark the state dirty if it's changed. */
+void
+conf_set_int(int *p, int val)
+{
+	if (*p != val) {
+		*p = val;
+		conf_dirty = 1;
+	}
+}
+
+void
+conf_set_int64(int64_t *p, int64_t val)
+{
+	if (*p != val) {
+		*p = val;
+		conf_dirty = 1;
+	}
+}
+
+/* utility: count up the statistics in the state file. */
+void
+conf_count(enum STATISTIC stat, int n)
+{
+	if (conf_map != MAP_FAILED)
+		atomic_fetch_add_explicit(&conf_map->cf_stats[stat], n,
+					  memory_order_relaxed);
+}
+
+/* utility: check and get the number from the key. */
+int
+conf_get_int(nvlist_t *conf, const char *key, int *val)
+{
+	if (! nvlist_exists_number(conf, key))
+		return -1;
+	*val = nvlist_get_number(conf, key);
+	return 0;
+}
+
+int
+get_saved_levels()
+{
+	struct asmc_driver_context *c;
+	nvlist_t *nl;
+
+	if (conf_map == MAP_FAILED)
+		return -1;
+
+	if ((nl = nvlist_create(0)) == NULL) {
+		fprintf(stderr, "nvlist_create: %s\n", conf_filename);
+		return -1;
+	}
+
+	read_slot(conf_map, nl);
+	ARRAY_FOREACH(c, asmc_contexts)
+		if (c->driver != NULL)
+			ASMC_LOAD(c, nl);
+
+	nvlist_destroy(nl);
+	return 0;
+}
+
+/* find the entry in the active slot, without allocating nvlist */
+static int
+find_entry(const char *name, int64_t *val)
+{
+	const struct conf_slot *s;
+	uint32_t i;
+
+	if (conf_map == MAP_FAILED || (s = active_slot(conf_map)) == NULL)
+		return -1;
+
+	for (i = 0; i < s->cs_nentries; i++)
+		if (strncmp(s->cs_entries[i].ce_name, name,
+			    CONF_NAMELEN) == 0) {
+			*val = s->cs_entries[i].ce_value;
+			return 0;
+		}
+	return -1;
+}
+
+/*
+  Get the driver index and the levels of the unit saved last time.
+  Returns -1 if nothing is saved.
+ */
+int
+conf_get_status(enum CATEGORY cat, int unit, int *driver,
+		struct asmc_levels *l)
+{
+	char name[CONF_NAMELEN];
+	int64_t v;
+
+	snprintf(name, sizeof(name), CONF_STATUS, asmc_category_name(cat),
+		 unit);
+	if (find_entry(name, &v) < 0)
+		return -1;
+
+	*driver = v >> (STATUS_SHIFT * 3);
+	l->al_current = unpack_level(v, 2);
+	l->al_economy = unpack_level(v, 1);
+	l->al_fullpower = unpack_level(v, 0);
+	return 0;
+}
+
+/* returns the AC power status saved last time or -1 */
+int
+conf_get_ac(void)
+{
+	int64_t v;
+
+	return (find_entry(CONF_STATUS_AC, &v) < 0) ? -1 : (v != 0);
+}
+
+/*
+  Print the saved levels in sysctl.conf(5) format.
+  It can be restored by sysctl(8).
+ */
+int
+export_conf_file(FILE *fp)
+{
+	const struct conf_slot *s;
+	uint32_t i;
+
+	if (conf_map == MAP_FAILED)
+		return -1;
+
+	fprintf(fp, "# Exported from %s by asmctl.\n", conf_filename);
+	if ((s = active_slot(conf_map)) == NULL)
+		return 0;
+
+	/* the records of the status are not levels */
+	for (i = 0; i < s->cs_nentries; i++)
+		if (s->cs_entries[i].ce_name[CONF_NAMELEN - 1] == '\0' &&
+		    strncmp(s->cs_entries[i].ce_name, CONF_STATUS_PREFIX,
+			    strlen(CONF_STATUS_PREFIX)) != 0)
+			fprintf(fp, "%s=%jd\n", s->cs_entries[i].ce_name,
+				(intmax_t)s->cs_entries[i].ce_value);
+	return 0;
+}
+
+uint64_t
+conf_stat(enum STATISTIC st)
+{
+	return (conf_map == MAP_FAILED) ? 0 :
+		atomic_load(&conf_map->cf_stats[st]);
+}
+
+/* Print the statistics. */
+int
+print_conf_stats(FILE *fp)
+{
+	int i;
+
+	if (conf_map == MAP_FAILED)
+		return -1;
+
+	for (i = 0; i < nitems(stat_names); i++)
+		fprintf(fp, "%s=%ju\n", stat_names[i],
+			(uintmax_t)atomic_load(&conf_map->cf_stats[i]));
+	return 0;
+}
+
+/* the wall clock is compared with the record of the last boot */
+static int64_t
+realtime_msec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* record the AC power status with the time. */
+void
+conf_set_ac(int powered)
+{
+	if (conf_map != MAP_FAILED)
+		atomic_store(&conf_map->cf_ac,
+			     realtime_msec() << 1 | (powered != 0));
+}
+
+/*
+  Get the AC power status recorded in 'max_age' milliseconds.
+  Returns -1 if it's not recorded, too old or the clock is set back.
+ */
+int
+conf_get_recent_ac(long max_age, int *powered)
+{
+	int64_t v, age;
+
+	if (conf_map == MAP_FAILED || (v = atomic_load(&conf_map->cf_ac)) == 0)
+		return -1;
+
+	age = realtime_msec() - (v >> 1);
+	if (age < 0 || age > max_age)
+		return -1;
+
+	*powered = v & 1;
+	return 0;
+}
+
+/*
+  Steps of up and down are coalesced by the processes. Every process
+  adds its steps to the pending counter of the category, and the
+  leader who has the lock of the counter applies the sum of them.
+ */
+void
+conf_pending_add(enum CATEGORY cat, int steps)
+{
+	if (conf_map != MAP_FAILED)
+		atomic_fetch_add(&conf_map->cf_pending[cat], steps);
+}
+
+/* take all of the pending steps of the category */
+int
+conf_pending_take(enum CATEGORY cat)
+{
+	int64_t steps;
+
+	if (conf_map == MAP_FAILED)
+		return 0;
+
+	/* the sum of the large steps doesn't fit in an int */
+	steps = atomic_exchange(&conf_map->cf_pending[cat], 0);
+	return MAX(-INT_MAX, MIN(steps, INT_MAX));
+}
+
+int
+conf_pending_get(enum CATEGORY cat)
+{
+	return (conf_map == MAP_FAILED) ? 0 :
+		atomic_load(&conf_map->cf_pending[cat]);
+}
+
+static int
+lock_pending(enum CATEGORY cat, short type)
+{
+	return lock_range(offsetof(struct conf_file, cf_pending[cat]),
+			  sizeof(conf_map->cf_pending[cat]), type, F_SETLK);
+}
+
+/*
+  Try to be the leader of the category. Returns 1 if it's succeeded,
+  0 if another process is the leader.
+ */
+int
+conf_lead(enum CATEGORY cat)
+{
+	if (lock_pending(cat, F_WRLCK) == 0)
+		return 1;
+	if (errno != EAGAIN && errno != EACCES)
+		fprintf(stderr, "can not lock %s: %s\n", conf_filename,
+			strerror(errno));
+	return 0;
+}
+
+void
+conf_unlead(enum CATEGORY cat)
+{
+	lock_pending(cat, F_UNLCK);
+}
+
+/* lock the bytes from the first category to the last one in 'cats' */
+static int
+lock_levels(unsigned cats, short type, int cmd)
+{
+	int cat, first = -1, last = -1;
+
+	for (cat = VIDEO; cat < CONF_NPENDING; cat++)
+		if (cats & CATEGORY_BIT(cat)) {
+			if (first < 0)
+				first = cat;
+			last = cat;
+		}
+	if (first < 0)
+		return 0;
+
+	return lock_range(CONF_LOCK_OFFSET(first), last - first + 1, type,
+			  cmd);
+}
+
+/*
+  Lock the levels of the categories in 'cats' for loading, changing and
+  storing them, waiting for another process that holds any of them.
+  The categories are locked at once not to deadlock.
+ */
+int
+conf_lock(unsigned cats)
+{
+	if (conf_map == MAP_FAILED)
+		return -1;
+
+	if (lock_levels(cats, F_WRLCK, F_SETLKW) < 0) {
+		fprintf(stderr, "can not lock %s: %s\n", conf_filename,
+			strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+  Lock the levels as conf_lock() without waiting, for the event loop of
+  asmctld(8). Returns 1 if it's locked, 0 if another process holds any
+  of them, -1 on error.
+ */
+int
+conf_trylock(unsigned cats)
+{
+	if (conf_map == MAP_FAILED)
+		return -1;
+
+	if (lock_levels(cats, F_WRLCK, F_SETLK) == 0)
+		return 1;
+	if (errno == EAGAIN || errno == EACCES)
+		return 0;
+	fprintf(stderr, "can not lock %s: %s\n", conf_filename,
+		strerror(errno));
+	return -1;
+}
+
+void
+conf_unlock(unsigned cats)
+{
+	if (conf_map != MAP_FAILED)
+		lock_levels(cats, F_UNLCK, F_SETLK);
+}
@@ -0,0 +1,314 @@
+/*-
+ * Copyright (c) 2026 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Listener of devd(8) notifications.
+ *
+ * asmctld(8) subscribes to the seqpacket socket of devd(8) and applies
+ * the AC power status of ACPI/ACAD notifications to the drivers in the
+ * process, instead of the 'notify' action that runs asmctl(1).
+ *
+ *  !system=ACPI subsystem=ACAD type=\_SB_.PCI0.AC notify=0x01
+ *
+ * The socket is connected again if devd(8) is restarted.
+ *
+ * A loose connector fires the notifications many times a second. The
+ * AC power status is applied after no notification comes in the settle
+ * window, and only if it differs from the status applied last time.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "asmctl.h"
+
+/* path of the devd(8) socket */
+char *devd_socket = DEVD_SOCKET;
+
+#ifdef USE_CAPSICUM
+/* the directory of the socket to connect in capability mode */
+static int devd_dirfd = -1;
+#endif
+
+/* milliseconds to wait for the AC power status to settle */
+long devd_settle_msec = DEVD_SETTLE;
+
+static int devd_fd = -1;
+static struct event_timer devd_timer;
+
+static void devd_reconnect(void *);
+static void on_settle(void *);
+
+/* the status to apply after settled and the one applied, -1 if none */
+static int ac_pending = -1;
+static int ac_applied = -1;
+static struct event_timer settle_timer = {.et_func = on_settle};
+
+/* connect to the devd(8) socket, returns the socket or -1. */
+int
+devd_open(const char *path)
+{
+	struct sockaddr_un sun;
+#ifdef USE_CAPSICUM
+	char buf[PATH_MAX];
+#endif
+	int s;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_LOCAL;
+	if (strlcpy(sun.sun_path, path, sizeof(sun.sun_path)) >=
+	    sizeof(sun.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if ((s = socket(PF_LOCAL, SOCK_SEQPACKET, 0)) < 0)
+		return -1;
+
+#ifdef USE_CAPSICUM
+	/* no global name space in capability mode */
+	if (devd_dirfd != -1) {
+		/* relative to the directory */
+		strlcpy(buf, path, sizeof(buf));
+		strlcpy(sun.sun_path, basename(buf), sizeof(sun.sun_path));
+		if (connectat(devd_dirfd, s, (struct sockaddr *)&sun,
+			      sizeof(sun)) < 0)
+			goto err;
+		return s;
+	}
+#endif
+	if (connect(s, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+		goto err;
+
+	return s;
+err:
+	close(s);
+	return -1;
+}
+
+/*
+  Parse a notification of the AC adapter. The message is modified.
+  Returns 0 and sets the AC line status, or -1 if it's not the one.
+ */
+int
+devd_parse(char *msg, int *acline)
+{
+	char *p, *key, *value;
+	int system = 0, subsystem = 0, notify = -1;
+
+	if (msg[0] != '!')
+		return -1;
+
+	p = &msg[1];
+	while ((value = strsep(&p, " \n")) != NULL) {
+		if ((key = strsep(&value, "=")) == NULL || value == NULL)
+			continue;
+		if (strcmp(key, "system") == 0)
+			system = (strcmp(value, "ACPI") == 0);
+		else if (strcmp(key, "subsystem") == 0)
+			subsystem = (strcmp(value, "ACAD") == 0);
+		else if (strcmp(key, "notify") == 0)
+			notify = strtol(value, NULL, 0);
+	}
+
+	if (! system || ! subsystem || notify < 0)
+		return -1;
+
+	*acline = (notify != 0);
+	return 0;
+}
+
+/*
+  Apply the last AC line status to the drivers, called when the events
+  are settled. The same status as the last one is not applied.
+  Returns 1 if applied, 0 if nothing is applied, -1 on error.
+ */
+int
+devd_settle(void)
+{
+	struct asmc_driver_context *c;
+	int locked, rc = 1;
+
+	event_timer_stop(&settle_timer);
+	if (ac_pending < 0)
+		return 0;
+	if (ac_pending == ac_applied) {
+		conf_count(STAT_AC_SUPPRESSED, 1);
+		ac_pending = -1;
+		return 0;
+	}
+
+	/* retried later while another process holds the levels */
+	if ((locked = conf_trylock(CATEGORY_ALL)) == 0) {
+		event_timer_set(&settle_timer, ASMCTLD_LOCK_RETRY);
+		return 0;
+	}
+
+	/* no need to read hw.acpi.acline */
+	ac_powered = ac_applied = ac_pending;
+	ac_pending = -1;
+
+	if (locked < 0 || get_saved_levels() < 0) {
+		conf_unlock(CATEGORY_ALL);
+		return -1;
+	}
+	idle_wake();
+	ARRAY_FOREACH(c, asmc_contexts)
+		if (c->driver != NULL && ASMC_ACPI(c) < 0)
+			rc = -1;
+	store_conf_file();
+	conf_unlock(CATEGORY_ALL);
+
+	return rc;
+}
+
+static void
+on_settle(void *arg)
+{
+	devd_settle();
+}
+
+/*
+  Take the AC line status, it's applied when settled.
+  Returns 1 if taken or applied, -1 on error.
+ */
+int
+devd_ac_event(int acline)
+{
+	conf_count(STAT_AC_EVENTS, 1);
+	/* asmctl(1) uses it at once, even in the settle window */
+	conf_set_ac(acline);
+
+	/* the status not applied yet is replaced */
+	if (ac_pending >= 0)
+		conf_count(STAT_AC_SUPPRESSED, 1);
+	ac_pending = acline;
+
+	if (devd_settle_msec <= 0)
+		return (devd_settle() < 0) ? -1 : 1;
+
+	/* the window starts again from the last one */
+	event_timer_set(&settle_timer, devd_settle_msec);
+	return 1;
+}
+
+/*
+  Take the AC line status of the message.
+  Returns 1 if taken, 0 if the message is ignored, -1 on error.
+ */
+int
+devd_handle(char *msg)
+{
+	int acline;
+
+	if (devd_parse(msg, &acline) < 0)
+		return 0;
+	return devd_ac_event(acline);
+}
+
+static void
+on_devd(int s, void *arg)
+{
+	char buf[DEVD_MSGSIZE];
+	ssize_t len;
+
+	if ((len = recv(s, buf, sizeof(buf) - 1, 0)) < 0 && errno == EINTR)
+		return;
+
+	if (len <= 0) {
+		/* devd(8) is restarted */
+		event_remove(s);
+		close(s);
+		devd_fd = -1;
+		event_timer_set(&devd_timer, DEVD_RETRY_INTERVAL);
+		return;
+	}
+
+	buf[len] = '\0';
+	devd_handle(buf);
+}
+
+static void
+devd_reconnect(void *arg)
+{
+	if ((devd_fd = devd_open(devd_socket)) < 0 ||
+	    event_add(devd_fd, on_devd, NULL) < 0) {
+		if (devd_fd != -1)
+			close(devd_fd);
+		devd_fd = -1;
+		event_timer_set(&devd_timer, DEVD_RETRY_INTERVAL);
+	}
+}
+
+/*
+  Start listening to devd(8) on the event loop. It must be called
+  before entering capability mode.
+ */
+int
+devd_listen(void)
+{
+#ifdef USE_CAPSICUM
+	char buf[PATH_MAX];
+	cap_rights_t dir_rights;
+#endif
+
+	event_timer_init(&devd_timer, devd_reconnect, NULL);
+
+#ifdef USE_CAPSICUM
+	strlcpy(buf, devd_socket, sizeof(buf));
+	if ((devd_dirfd = open(dirname(buf), O_DIRECTORY | O_CLOEXEC)) < 0) {
+		fprintf(stderr, "can not open %s: %s\n", buf,
+			strerror(errno));
+		return -1;
+	}
+	cap_rights_init(&dir_rights, CAP_LOOKUP, CAP_CONNECTAT);
+	if (cap_rights_limit(devd_dirfd, &dir_rights) < 0) {
+		fprintf(stderr, "cap_rights_limit() failed\n");
+		return -1;
+	}
+#endif
+
+	/* devd(8) may start later */
+	if ((devd_fd = devd_open(devd_socket)) < 0) {
+		fprintf(stderr, "can not connect %s: %s\n", devd_socket,
+			strerror(errno));
+		event_timer_set(&devd_timer, DEVD_RETRY_INTERVAL);
+		return 0;
+	}
+
+	return event_add(devd_fd, on_devd, NULL);
+}
@@ -0,0 +1,234 @@
+/*-
+ * Copyright (c) 2026 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Event loop of asmctld(8).
+ *
+ * It waits for the file descriptors and the timers by one ppoll(2).
+ * The timeout is the nearest deadline of the timers, so that the loop
+ * never wakes up if nothing is going to happen.
+ *
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE 1	/* ppoll(2) of glibc */
+#endif
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <time.h>
+
+#include "asmctl.h"
+
+struct event_source {
+	int es_fd;
+	void (*es_func)(int, void *);
+	void *es_arg;
+};
+
+static struct event_source sources[EVENT_MAXSOURCES];
+static int nsources = 0;
+
+static LIST_HEAD(, event_timer) timers = LIST_HEAD_INITIALIZER(timers);
+
+/* utility: add milliseconds to the timespec */
+void
+timespec_add_msec(struct timespec *ts, long msec)
+{
+	ts->tv_sec += msec / 1000;
+	ts->tv_nsec += (msec % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+/* utility: returns milliseconds from 'b' to 'a' */
+long
+timespec_diff_msec(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000 +
+		(a->tv_nsec - b->tv_nsec) / 1000000;
+}
+
+static int
+timespec_cmp(const struct timespec *a, const struct timespec *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return (a->tv_sec < b->tv_sec) ? -1 : 1;
+	if (a->tv_nsec != b->tv_nsec)
+		return (a->tv_nsec < b->tv_nsec) ? -1 : 1;
+	return 0;
+}
+
+int
+event_add(int fd, void (*func)(int, void *), void *arg)
+{
+	if (nsources == EVENT_MAXSOURCES) {
+		fprintf(stderr, "too many event sources\n");
+		return -1;
+	}
+	sources[nsources].es_fd = fd;
+	sources[nsources].es_func = func;
+	sources[nsources].es_arg = arg;
+	nsources++;
+	return 0;
+}
+
+void
+event_remove(int fd)
+{
+	int i;
+
+	for (i = 0; i < nsources; i++)
+		if (sources[i].es_fd == fd) {
+			sources[i] = sources[--nsources];
+			return;
+		}
+}
+
+void
+event_timer_init(struct event_timer *t, void (*func)(void *), void *arg)
+{
+	memset(t, 0, sizeof(*t));
+	t->et_func = func;
+	t->et_arg = arg;
+}
+
+/* (re)arm the timer at the absolute time of CLOCK_MONOTONIC */
+void
+event_timer_set_abs(struct event_timer *t, const struct timespec *deadline)
+{
+	if (! t->et_armed) {
+		LIST_INSERT_HEAD(&timers, t, et_link);
+		t->et_armed = 1;
+	}
+	t->et_deadline = *deadline;
+}
+
+/* (re)arm the timer 'msec' milliseconds later */
+void
+event_timer_set(struct event_timer *t, long msec)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	timespec_add_msec(&ts, msec);
+	event_timer_set_abs(t, &ts);
+}
+
+void
+event_timer_stop(struct event_timer *t)
+{
+	if (t->et_armed) {
+		LIST_REMOVE(t, et_link);
+		t->et_armed = 0;
+	}
+}
+
+static struct event_timer *
+nearest_timer()
+{
+	struct event_timer *t, *n = NULL;
+
+	LIST_FOREACH(t, &timers, et_link)
+		if (n == NULL || timespec_cmp(&t->et_deadline,
+					      &n->et_deadline) < 0)
+			n = t;
+	return n;
+}
+
+/*
+  Run the loop until '*terminated' is set. The signals are unblocked
+  by 'mask' only while waiting for events.
+ */
+int
+event_loop(const sigset_t *mask, volatile sig_atomic_t *terminated)
+{
+	struct pollfd fds[EVENT_MAXSOURCES];
+	struct timespec now, timeout, *tsp;
+	struct event_timer *t;
+	int i, j, n;
+
+	while (! *terminated) {
+		for (i = 0; i < nsources; i++) {
+			fds[i].fd = sources[i].es_fd;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+		n = nsources;
+
+		tsp = NULL;
+		if ((t = nearest_timer()) != NULL) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			timeout.tv_sec = timeout.tv_nsec = 0;
+			if (timespec_cmp(&t->et_deadline, &now) > 0) {
+				timeout.tv_sec = t->et_deadline.tv_sec -
+					now.tv_sec;
+				timeout.tv_nsec = t->et_deadline.tv_nsec -
+					now.tv_nsec;
+				if (timeout.tv_nsec < 0) {
+					timeout.tv_sec--;
+					timeout.tv_nsec += 1000000000;
+				}
+			}
+			tsp = &timeout;
+		}
+
+		if (ppoll(fds, n, tsp, mask) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "ppoll: %s\n", strerror(errno));
+			return -1;
+		}
+
+		/* the callback may set the timer again */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		while ((t = nearest_timer()) != NULL &&
+		       timespec_cmp(&t->et_deadline, &now) <= 0) {
+			event_timer_stop(t);
+			t->et_func(t->et_arg);
+		}
+
+		/* the callback may add or remove the sources */
+		for (i = 0; i < n; i++) {
+			if (fds[i].revents == 0)
+				continue;
+			for (j = 0; j < nsources; j++)
+				if (sources[j].es_fd == fds[i].fd) {
+					sources[j].es_func(fds[i].fd,
+							   sources[j].es_arg);
+					break;
+				}
+		}
+	}
+
+	return 0;
+}
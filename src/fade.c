@@ -0,0 +1,197 @@
+/*-
+ * Copyright (c) 2026 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Fade the brightness from the current level to the target.
+ *
+ * Each frame is paced by the absolute time of CLOCK_MONOTONIC, and
+ * writes the level at most once. Frames are not scheduled faster than
+ * the level changes. asmctl(1) runs the fade until it ends, asmctld(8)
+ * runs it on the event loop and a new target given while fading
+ * starts a new fade from the current level.
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+
+#include "asmctl.h"
+
+/* duration of a fade in milliseconds, 0 sets the level at once */
+int fade_duration = 0;
+
+/* set 1 to run fades on the event loop */
+int fade_async = 0;
+
+static void fade_timer(void *);
+
+void
+fade_init(struct fade *f, int (*write)(void *, int), void *arg)
+{
+	memset(f, 0, sizeof(*f));
+	f->fa_write = write;
+	f->fa_arg = arg;
+	f->fa_level = -1;
+	event_timer_init(&f->fa_timer, fade_timer, f);
+}
+
+/* set the levels that the hardware accepts, NULL for any level */
+void
+fade_set_levels(struct fade *f, const struct level_table *t)
+{
+	f->fa_table = t;
+}
+
+/* returns the level at the 'elapsed' milliseconds from the start */
+static int
+fade_level(const struct fade *f, long elapsed)
+{
+	int from, to;
+
+	if (elapsed >= f->fa_duration)
+		return f->fa_to;
+
+	if (f->fa_table == NULL)
+		return f->fa_from +
+			(f->fa_to - f->fa_from) * elapsed / f->fa_duration;
+
+	from = level_index(f->fa_table, f->fa_from);
+	to = level_index(f->fa_table, f->fa_to);
+	return f->fa_table->lt_levels[from + (to - from) * elapsed /
+				      f->fa_duration];
+}
+
+static int
+fade_write(struct fade *f, int level)
+{
+	struct trace_mark tm;
+	int rc;
+
+	trace_begin(&tm, PHASE_WRITE);
+	rc = f->fa_write(f->fa_arg, level);
+	trace_end(&tm);
+
+	return rc;
+}
+
+/* write a frame. returns 1 if the fade continues. */
+static int
+fade_frame(struct fade *f, const struct timespec *now)
+{
+	int level = fade_level(f, timespec_diff_msec(now, &f->fa_start));
+
+	if (level != f->fa_level) {
+		if (fade_write(f, level) < 0) {
+			f->fa_active = 0;
+			return -1;
+		}
+		f->fa_level = level;
+	}
+
+	if (level == f->fa_to) {
+		f->fa_active = 0;
+		return 0;
+	}
+
+	timespec_add_msec(&f->fa_next, f->fa_interval);
+	return 1;
+}
+
+static void
+fade_timer(void *arg)
+{
+	struct fade *f = arg;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (fade_frame(f, &now) > 0)
+		event_timer_set_abs(&f->fa_timer, &f->fa_next);
+}
+
+/*
+  Fade from the level 'from' to 'to'. The level is set at once if
+  fading is disabled or 'from' is unknown.
+ */
+int
+fade_to(struct fade *f, int from, int to)
+{
+	struct timespec now;
+	int rc, steps;
+
+	/* start from the level on the screen */
+	if (f->fa_active)
+		from = f->fa_level;
+
+	event_timer_stop(&f->fa_timer);
+	f->fa_active = 0;
+
+	if (fade_duration <= 0 || from < 0) {
+		if ((rc = fade_write(f, to)) == 0)
+			f->fa_level = to;
+		return rc;
+	}
+
+	if (from == to)
+		return 0;
+
+	steps = (f->fa_table == NULL) ? abs(to - from) :
+		abs(level_index(f->fa_table, to) -
+		    level_index(f->fa_table, from));
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	f->fa_from = from;
+	f->fa_to = to;
+	f->fa_level = from;
+	f->fa_start = f->fa_next = now;
+	/* asmctld(8) may change the duration for a command */
+	f->fa_duration = fade_duration;
+	f->fa_interval = MAX(FADE_MIN_INTERVAL, fade_duration / MAX(steps, 1));
+	f->fa_active = 1;
+
+	if (fade_async) {
+		fade_timer(f);
+		return 0;
+	}
+
+	while ((rc = fade_frame(f, &now)) > 0) {
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				       &f->fa_next, NULL) == EINTR)
+			;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	}
+
+	return rc;
+}
+
+int
+fade_is_active(const struct fade *f)
+{
+	return f->fa_active;
+}
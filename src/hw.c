@@ -0,0 +1,230 @@
+/*-
+ * Copyright (c) 2026 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Access to the hardware.
+ *
+ * The drivers call the HW_* macros instead of sysctlbyname(3), open(2),
+ * ioctl(2) and so on, so that the fake hardware in hw_fake.c can be
+ * used to measure them without an Apple machine.
+ *
+ * The sysctl names are resolved to the MIBs only once. It saves the
+ * kernel from looking up the names on every call. The MIBs are resolved
+ * before entering the capability mode and allowed in the limits of
+ * casper(3) with the names, that are used to resolve them again. The old
+ * casper(3) without cap_sysctl_limit_name(3) accepts the names only.
+ *
+ * Linux has no sysctl(3), the nodes are not found as on the machines
+ * without the drivers.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "asmctl.h"
+
+/* config.h is included by asmctl.h */
+#ifdef HAVE_SYS_SYSCTL_H
+#include <sys/sysctl.h>
+
+#define MIB_CACHE_SIZE  16
+#define MIB_NAMELEN     64
+
+struct mib_entry {
+	char me_name[MIB_NAMELEN];
+	int me_mib[CTL_MAXNAME];
+	u_int me_len;
+};
+
+/* resolved MIBs, the entries are never removed */
+static struct mib_entry mib_cache[MIB_CACHE_SIZE];
+static int mib_count = 0;
+static pthread_mutex_t mib_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef USE_CAPSICUM
+/* a casper channel can't be shared by the threads at the same time */
+static pthread_mutex_t casper_lock = PTHREAD_MUTEX_INITIALIZER;
+#ifdef HAVE_CAP_SYSCTL_LIMIT_NAME
+#define CASPER_MIB 1
+#endif
+#endif
+
+static int
+name_to_mib(const char *name, int *mib, u_int *len)
+{
+	size_t n = CTL_MAXNAME;
+	int rc;
+
+#ifdef CASPER_MIB
+	if (ch_sysctl != NULL) {
+		pthread_mutex_lock(&casper_lock);
+		rc = cap_sysctlnametomib(ch_sysctl, name, mib, &n);
+		pthread_mutex_unlock(&casper_lock);
+	} else
+#endif
+		rc = sysctlnametomib(name, mib, &n);
+	*len = n;
+	return rc;
+}
+
+static int
+mib_sysctl(const int *mib, u_int len, void *old, size_t *oldlen,
+	   const void *new, size_t newlen)
+{
+#ifdef CASPER_MIB
+	int rc;
+
+	if (ch_sysctl != NULL) {
+		pthread_mutex_lock(&casper_lock);
+		rc = cap_sysctl(ch_sysctl, mib, len, old, oldlen, new, newlen);
+		pthread_mutex_unlock(&casper_lock);
+		return rc;
+	}
+#endif
+	return sysctl(mib, len, old, oldlen, new, newlen);
+}
+
+/*
+  Get the MIB of the name, resolve it if it's not cached yet or
+  'refresh' is set. Returns -1 if the name is not found.
+ */
+static int
+lookup_mib(const char *name, int *mib, u_int *len, int refresh)
+{
+	struct mib_entry *e;
+	int rc = 0;
+
+	pthread_mutex_lock(&mib_lock);
+	for (e = &mib_cache[0]; e < &mib_cache[mib_count]; e++)
+		if (strcmp(e->me_name, name) == 0)
+			break;
+
+	if (e < &mib_cache[mib_count] && ! refresh) {
+		memcpy(mib, e->me_mib, sizeof(int) * e->me_len);
+		*len = e->me_len;
+	} else if ((rc = name_to_mib(name, mib, len)) == 0 &&
+		   e < &mib_cache[nitems(mib_cache)] &&
+		   strlen(name) < sizeof(e->me_name)) {
+		/* a failed lookup doesn't break the cached MIB */
+		memcpy(e->me_mib, mib, sizeof(int) * *len);
+		e->me_len = *len;
+		if (e == &mib_cache[mib_count]) {
+			strlcpy(e->me_name, name, sizeof(e->me_name));
+			mib_count++;
+		}
+	}
+	pthread_mutex_unlock(&mib_lock);
+
+	return rc;
+}
+
+#ifdef USE_CAPSICUM
+/*
+  Allow the name and its MIB in the limits of casper(3). It's called
+  before entering the capability mode to resolve the MIB.
+ */
+void
+hw_sysctl_limit(cap_sysctl_limit_t *limits, const char *name, int flags)
+{
+#ifdef CASPER_MIB
+	int mib[CTL_MAXNAME];
+	u_int len;
+
+	if (lookup_mib(name, mib, &len, 0) == 0)
+		cap_sysctl_limit_mib(limits, mib, len, flags);
+#endif
+	cap_sysctl_limit_name(limits, name, flags);
+}
+#endif
+
+#endif
+
+static int
+real_sysctl(const char *name, void *old, size_t *oldlen, const void *new,
+	    size_t newlen)
+{
+#ifdef HAVE_SYS_SYSCTL_H
+	int mib[CTL_MAXNAME], rc;
+	u_int len;
+
+#if defined(USE_CAPSICUM) && ! defined(CASPER_MIB)
+	if (ch_sysctl != NULL) {
+		pthread_mutex_lock(&casper_lock);
+		rc = cap_sysctlbyname(ch_sysctl, name, old, oldlen, new,
+				      newlen);
+		pthread_mutex_unlock(&casper_lock);
+		return rc;
+	}
+#endif
+
+	if (lookup_mib(name, mib, &len, 0) < 0)
+		return -1;
+
+	rc = mib_sysctl(mib, len, old, oldlen, new, newlen);
+
+	/* the node may be created again, such as by reloading the module */
+	if (rc < 0 && errno == ENOENT && lookup_mib(name, mib, &len, 1) == 0)
+		rc = mib_sysctl(mib, len, old, oldlen, new, newlen);
+
+	return rc;
+#else
+	errno = ENOENT;
+	return -1;
+#endif
+}
+
+static int
+real_open(const char *path, int flags)
+{
+	return open(path, flags);
+}
+
+static int
+real_ioctl(int fd, unsigned long request, void *arg)
+{
+	return ioctl(fd, request, arg);
+}
+
+struct asmc_hw hw_real =
+{
+	.name = "real",
+	.sysctl = real_sysctl,
+	.open = real_open,
+	.close = close,
+	.ioctl = real_ioctl,
+	.pread = pread,
+	.pwrite = pwrite
+};
+
+/* hardware in use */
+struct asmc_hw *asmc_hw = &hw_real;
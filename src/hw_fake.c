@@ -0,0 +1,345 @@
+/*-
+ * Copyright (c) 2026 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Fake hardware for the benchmark.
+ *
+ * It has an in-memory sysctl tree and backlight(9) devices that look
+ * like a MacBook. The backlight devices are the files named
+ * 'backlight<N>' in 'backlight_dir'. Every call sleeps for the injected latency to
+ * simulate a slow firmware. Other files are opened as usual, so that
+ * the sysfs drivers work on a fake directory tree. The values are shared
+ * by the processes forked after the initialization.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "asmctl.h"
+
+/* config.h is included by asmctl.h */
+#ifdef HAVE_SYS_BACKLIGHT_H
+#include <sys/backlight.h>
+#endif
+
+#define FAKE_MAXVALUES    24
+#define FAKE_DEVICE       "backlight"
+
+struct fake_sysctl {
+	const char *fs_name;
+	int fs_nvalues;
+	int fs_values[FAKE_MAXVALUES];
+};
+
+static const struct fake_sysctl fake_defaults[] = {
+	{"hw.acpi.acline", 1, {1}},
+	/* fullpower, economy and the levels */
+	{"hw.acpi.video.lcd0.levels", 19,
+	 {100, 44, 0, 6, 12, 18, 25, 31, 37, 44, 50, 56, 62, 68, 75, 81,
+	  87, 93, 100}},
+	{"hw.acpi.video.lcd0.economy", 1, {44}},
+	{"hw.acpi.video.lcd0.fullpower", 1, {100}},
+	{"hw.acpi.video.lcd0.brightness", 1, {100}},
+	{"dev.asmc.0.light.control", 1, {50}},
+	{"dev.asmc.0.light.left", 1, {0}},
+	{"dev.asmc.0.light.right", 1, {0}},
+};
+
+/* the values, in the shared memory */
+struct fake_state {
+	struct fake_sysctl fk_tree[nitems(fake_defaults)];
+	int fk_brightness[ASMC_MAXUNITS];
+};
+
+static struct fake_state *fake = MAP_FAILED;
+
+/* number of the calls */
+_Atomic unsigned long hw_fake_calls;
+
+/* latency of a call in microseconds */
+static long fake_latency;
+
+struct fake_backlight {
+	int fb_fd;
+	int *fb_brightness;
+};
+
+static struct fake_backlight fake_backlights[ASMC_MAXUNITS];
+static int fake_nbacklights;
+
+/* the panel shows the multiples of it, rounding a brightness down */
+static int fake_quantum = 1;
+
+static void
+fake_delay(void)
+{
+	struct timespec ts;
+
+	hw_fake_calls++;
+	if (fake_latency <= 0)
+		return;
+
+	ts.tv_sec = fake_latency / 1000000;
+	ts.tv_nsec = fake_latency % 1000000 * 1000;
+	nanosleep(&ts, NULL);
+}
+
+static struct fake_sysctl *
+fake_lookup(const char *name)
+{
+	struct fake_sysctl *p;
+
+	ARRAY_FOREACH(p, fake->fk_tree)
+		if (strcmp(p->fs_name, name) == 0)
+			return p;
+	return NULL;
+}
+
+static int
+fake_sysctl(const char *name, void *old, size_t *oldlen, const void *new,
+	    size_t newlen)
+{
+	struct fake_sysctl *p;
+	size_t len;
+
+	fake_delay();
+
+	if ((p = fake_lookup(name)) == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	len = p->fs_nvalues * sizeof(int);
+	if (oldlen != NULL) {
+		if (old != NULL) {
+			if (*oldlen < len) {
+				errno = ENOMEM;
+				return -1;
+			}
+			memcpy(old, p->fs_values, len);
+		}
+		*oldlen = len;
+	}
+
+	if (new != NULL) {
+		if (newlen < sizeof(int) || newlen > sizeof(p->fs_values)) {
+			errno = EINVAL;
+			return -1;
+		}
+		memcpy(p->fs_values, new, newlen);
+		p->fs_nvalues = newlen / sizeof(int);
+	}
+
+	return 0;
+}
+
+static struct fake_backlight *
+fake_backlight(int fd)
+{
+	struct fake_backlight *b;
+
+	ARRAY_FOREACH(b, fake_backlights)
+		if (b->fb_fd == fd && fd != -1)
+			return b;
+	return NULL;
+}
+
+static int
+fake_open(const char *path, int flags)
+{
+	size_t len = strlen(backlight_dir);
+	struct fake_backlight *b;
+	int n;
+
+	fake_delay();
+
+	if (strncmp(path, backlight_dir, len) != 0 || path[len] != '/' ||
+	    sscanf(&path[len + 1], FAKE_DEVICE "%d", &n) != 1)
+		return open(path, flags);
+
+	/* a real descriptor is needed for fstat(2) */
+	if (n < 0 || n >= fake_nbacklights ||
+	    (b = &fake_backlights[n])->fb_fd != -1 ||
+	    (b->fb_fd = open("/dev/null", O_RDWR)) < 0) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	return b->fb_fd;
+}
+
+static int
+fake_close(int fd)
+{
+	struct fake_backlight *b;
+
+	fake_delay();
+
+	if ((b = fake_backlight(fd)) != NULL)
+		b->fb_fd = -1;
+	return close(fd);
+}
+
+static int
+fake_ioctl(int fd, unsigned long request, void *arg)
+{
+#ifdef HAVE_SYS_BACKLIGHT_H
+	struct backlight_props *props = arg;
+#endif
+	struct fake_backlight *b;
+
+	fake_delay();
+
+	if ((b = fake_backlight(fd)) == NULL) {
+		errno = ENOTTY;
+		return -1;
+	}
+
+	switch (request) {
+#ifdef HAVE_SYS_BACKLIGHT_H
+	case BACKLIGHTGETSTATUS:
+		memset(props, 0, sizeof(*props));
+		props->brightness = *b->fb_brightness;
+		/* the levels are generated */
+		props->nlevels = 0;
+		return 0;
+	case BACKLIGHTUPDATESTATUS:
+		*b->fb_brightness = props->brightness -
+			props->brightness % fake_quantum;
+		return 0;
+#endif
+	default:
+		break;
+	}
+
+	errno = ENOTTY;
+	return -1;
+}
+
+static ssize_t
+fake_pread(int fd, void *buf, size_t len, off_t offset)
+{
+	fake_delay();
+	return pread(fd, buf, len, offset);
+}
+
+static ssize_t
+fake_pwrite(int fd, const void *buf, size_t len, off_t offset)
+{
+	fake_delay();
+	return pwrite(fd, buf, len, offset);
+}
+
+struct asmc_hw hw_fake =
+{
+	.name = "fake",
+	.sysctl = fake_sysctl,
+	.open = fake_open,
+	.close = fake_close,
+	.ioctl = fake_ioctl,
+	.pread = fake_pread,
+	.pwrite = fake_pwrite
+};
+
+/*
+  Use the fake hardware with the latency in microseconds.
+  The 'backlights' devices of backlight(9) are available if the files
+  are in 'backlight_dir'.
+ */
+int
+hw_fake_init(long latency, int backlights)
+{
+	struct fake_backlight *b;
+
+	if (fake == MAP_FAILED &&
+	    (fake = mmap(NULL, sizeof(*fake), PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_ANON, -1, 0)) == MAP_FAILED) {
+		fprintf(stderr, "mmap: %s\n", strerror(errno));
+		return -1;
+	}
+
+	memcpy(fake->fk_tree, fake_defaults, sizeof(fake->fk_tree));
+	fake_latency = latency;
+	fake_quantum = 1;
+	fake_nbacklights = MIN(backlights, nitems(fake_backlights));
+	ARRAY_FOREACH(b, fake_backlights) {
+		b->fb_fd = -1;
+		b->fb_brightness = &fake->fk_brightness[b - fake_backlights];
+		*b->fb_brightness = 100;
+	}
+	hw_fake_calls = 0;
+	asmc_hw = &hw_fake;
+
+	return 0;
+}
+
+/* read a value of the fake sysctl tree without the latency. */
+int
+hw_fake_get(const char *name, int *val)
+{
+	struct fake_sysctl *p;
+
+	if ((p = fake_lookup(name)) == NULL)
+		return -1;
+	*val = p->fs_values[0];
+	return 0;
+}
+
+/* change a value of the fake sysctl tree, such as 'hw.acpi.acline'. */
+int
+hw_fake_set(const char *name, int val)
+{
+	struct fake_sysctl *p;
+
+	if ((p = fake_lookup(name)) == NULL)
+		return -1;
+	p->fs_values[0] = val;
+	return 0;
+}
+
+/* the panels show only the multiples of 'quantum' */
+void
+hw_fake_panel(int quantum)
+{
+	fake_quantum = MAX(quantum, 1);
+}
+
+/* read the brightness that the backlight(9) device shows. */
+int
+hw_fake_brightness(int unit, int *val)
+{
+	if (fake == MAP_FAILED || unit < 0 || unit >= fake_nbacklights)
+		return -1;
+	*val = fake->fk_brightness[unit];
+	return 0;
+}
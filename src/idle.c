@@ -0,0 +1,301 @@
+/*-
+ * Copyright (c) 2026 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Idle dimming of the keyboard backlight.
+ *
+ * asmctld(8) reads an input activity source, such as a keyboard of
+ * evdev(4), and fades the keyboard backlight to 0 if no input comes in
+ * the timeout. The level in the state file is kept and the backlight is
+ * lit again on the next input.
+ *
+ * One timer is used. After an input, the source is not watched and the
+ * timer checks it IDLE_CHECKS times in a timeout, so that typing wakes
+ * up the loop a few times a timeout instead of on every key. While
+ * dimmed, the timer is stopped and only an input wakes up the loop. The
+ * wakeups are counted in the statistics.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "asmctl.h"
+
+enum IDLE_STATE {
+	IDLE_WATCHING = 0,  /* waiting for an input or the timeout */
+	IDLE_CHECKING,      /* an input came, checking for more */
+	IDLE_DIMMED
+};
+
+/* the input activity source and the timeout, 0 disables dimming */
+char *idle_source = IDLE_SOURCE;
+long idle_timeout_msec = 0;
+/* the duration of the dim while fade_duration is 0 */
+long idle_fade_msec = IDLE_FADE;
+
+static void on_idle(void *);
+
+static int idle_fd = -1;
+static int idle_watched = 0;
+static enum IDLE_STATE idle_state = IDLE_WATCHING;
+static long idle_last;  /* msec of the last input */
+static struct event_timer idle_timer = {.et_func = on_idle};
+
+static long
+monotonic_msec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+  Fade the keyboard backlights to 0 or back to the current level. The
+  dim is not cut at once without -F, the light comes back as the input
+  does.
+ */
+static void
+idle_dim(int dim)
+{
+	struct asmc_driver_context *c;
+	int fade_msec = fade_duration;
+
+	if (dim && fade_duration <= 0)
+		fade_duration = idle_fade_msec;
+
+	ARRAY_FOREACH(c, asmc_contexts)
+		if (c->driver != NULL && c->category == KEYBOARD &&
+		    c->driver->dim != NULL)
+			ASMC_DIM(c, dim);
+
+	fade_duration = fade_msec;
+}
+
+/* an input at 'now', returns the msec to the timer */
+static long
+idle_activity(long now)
+{
+	if (idle_state == IDLE_DIMMED)
+		idle_dim(0);
+	idle_state = IDLE_CHECKING;
+	idle_last = now;
+	return idle_timeout_msec / IDLE_CHECKS;
+}
+
+/* start counting the timeout at 'now', returns the msec to the timer */
+long
+idle_reset(long now)
+{
+	idle_state = IDLE_WATCHING;
+	idle_last = now;
+	return idle_timeout_msec;
+}
+
+/* the source is readable at 'now', returns the msec to the timer */
+long
+idle_input(long now)
+{
+	conf_count(STAT_IDLE_INPUT_WAKEUPS, 1);
+	return idle_activity(now);
+}
+
+/*
+  The timer expires at 'now', 'input' is set if the source has got an
+  input since it was checked last. Returns the msec to the timer or -1
+  to stop it.
+ */
+long
+idle_expire(long now, int input)
+{
+	conf_count(STAT_IDLE_TIMER_WAKEUPS, 1);
+
+	/* the input came in the check interval at most */
+	if (input)
+		return idle_activity(now);
+
+	if (idle_state == IDLE_CHECKING) {
+		idle_state = IDLE_WATCHING;
+		return idle_last + idle_timeout_msec - now;
+	}
+
+	/* no input in the timeout */
+	idle_dim(1);
+	idle_state = IDLE_DIMMED;
+	conf_count(STAT_IDLE_DIMS, 1);
+	return -1;
+}
+
+/* the source is watched by the event loop unless checked by the timer */
+int
+idle_watching(void)
+{
+	return idle_state != IDLE_CHECKING;
+}
+
+int
+idle_is_dimmed(void)
+{
+	return idle_state == IDLE_DIMMED;
+}
+
+/*
+  Read all of the inputs on the source.
+  Returns 1 if read, 0 if nothing, -1 if the source is closed.
+ */
+static int
+idle_drain(int fd)
+{
+	char buf[1024];
+	ssize_t len;
+	int rc = 0;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0)
+		rc = 1;
+
+	if (len == 0 || (errno != EAGAIN && errno != EINTR)) {
+		fprintf(stderr, "%s is closed\n", idle_source);
+		return -1;
+	}
+	return rc;
+}
+
+static void on_input(int, void *);
+
+/* watch the source and set the timer as the state requires */
+static void
+idle_schedule(long next)
+{
+	if (idle_watching() && ! idle_watched) {
+		if (event_add(idle_fd, on_input, NULL) == 0)
+			idle_watched = 1;
+	} else if (! idle_watching() && idle_watched) {
+		event_remove(idle_fd);
+		idle_watched = 0;
+	}
+
+	if (next < 0)
+		event_timer_stop(&idle_timer);
+	else
+		event_timer_set(&idle_timer, next);
+}
+
+static void
+on_input(int fd, void *arg)
+{
+	int rc;
+
+	if ((rc = idle_drain(fd)) < 0)
+		idle_stop();
+	else if (rc > 0)
+		idle_schedule(idle_input(monotonic_msec()));
+}
+
+static void
+on_idle(void *arg)
+{
+	int rc;
+
+	/* an input may come just before the timeout as well */
+	if ((rc = idle_drain(idle_fd)) < 0) {
+		idle_stop();
+		return;
+	}
+	idle_schedule(idle_expire(monotonic_msec(), rc));
+}
+
+/* a command is an input as well, the backlight is lit to change it */
+void
+idle_wake(void)
+{
+	if (idle_fd >= 0 && idle_is_dimmed())
+		idle_schedule(idle_activity(monotonic_msec()));
+}
+
+/* open the source and start the timer on the event loop */
+int
+idle_start(void)
+{
+	struct stat st;
+#ifdef USE_CAPSICUM
+	cap_rights_t fd_rights;
+#endif
+
+	if ((idle_fd = open(idle_source, O_RDONLY | O_NONBLOCK |
+			    O_CLOEXEC)) < 0) {
+		fprintf(stderr, "can not open %s: %s\n", idle_source,
+			strerror(errno));
+		return -1;
+	}
+
+	/* a FIFO is opened for writing as well, not to read the end of it */
+	if (fstat(idle_fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+		close(idle_fd);
+		if ((idle_fd = open(idle_source, O_RDWR | O_NONBLOCK |
+				    O_CLOEXEC)) < 0) {
+			fprintf(stderr, "can not open %s: %s\n", idle_source,
+				strerror(errno));
+			return -1;
+		}
+	}
+
+#ifdef USE_CAPSICUM
+	cap_rights_init(&fd_rights, CAP_READ, CAP_EVENT);
+	if (cap_rights_limit(idle_fd, &fd_rights) < 0) {
+		fprintf(stderr, "cap_rights_limit() failed\n");
+		return -1;
+	}
+#endif
+
+	idle_schedule(idle_reset(monotonic_msec()));
+	return 0;
+}
+
+/* light the backlight and stop dimming */
+void
+idle_stop(void)
+{
+	if (idle_fd < 0)
+		return;
+
+	if (idle_is_dimmed())
+		idle_dim(0);
+	idle_state = IDLE_WATCHING;
+
+	if (idle_watched)
+		event_remove(idle_fd);
+	idle_watched = 0;
+	event_timer_stop(&idle_timer);
+	close(idle_fd);
+	idle_fd = -1;
+}
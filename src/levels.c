@@ -0,0 +1,316 @@
+/*-
+ * Copyright (c) 2026 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Table of the brightness levels that a device accepts.
+ *
+ * The levels are in 0..100 and sorted. The maps from a value to the
+ * index of the levels are made when the table is built, so that a
+ * step or a snap to the nearest level is resolved in constant time
+ * however many levels the device has.
+ *
+ * The steps of up and down follow a perceptual curve. The table of the
+ * curve is built once for each curve and number of steps and shared by
+ * all of the drivers.
+ *
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "asmctl.h"
+
+/* the curve given by the command line, 0 steps is the driver default */
+enum CURVE curve_type = CURVE_LINEAR;
+int curve_steps = 0;
+
+static const char *curve_names[] = {
+	[CURVE_LINEAR] = "linear",
+	[CURVE_GAMMA] = "gamma",
+	[CURVE_CIELAB] = "cie"
+};
+
+/*
+  The tables built for each curve and number of steps, they are never
+  freed while the drivers use them. The batch workers look them up at
+  the same time.
+ */
+static struct level_table *curve_tables[nitems(curve_names)][LEVEL_MAXLEVELS];
+static pthread_mutex_t curve_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* build the table from the sorted levels. duplicated levels are removed. */
+int
+level_table_init(struct level_table *t, const int *levels, int n)
+{
+	int i, v;
+
+	if (n < 1 || n > LEVEL_MAXLEVELS) {
+		fprintf(stderr, "invalid number of levels: %d\n", n);
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+		if (levels[i] < 0 || levels[i] > LEVEL_MAX ||
+		    (i > 0 && levels[i] < levels[i - 1])) {
+			fprintf(stderr, "invalid level: %d\n", levels[i]);
+			return -1;
+		}
+
+	t->lt_nlevels = 0;
+	for (i = 0; i < n; i++)
+		if (i == 0 || levels[i] != levels[i - 1])
+			t->lt_levels[t->lt_nlevels++] = levels[i];
+	levels = t->lt_levels;
+	n = t->lt_nlevels;
+
+	for (v = 0, i = 0; v <= LEVEL_MAX; v++) {
+		while (i < n && levels[i] < v)
+			i++;
+		t->lt_ceil[v] = i;
+		/* choose the nearer one of levels[i - 1] and levels[i] */
+		if (i == n || (i > 0 && v - levels[i - 1] < levels[i] - v))
+			t->lt_nearest[v] = i - 1;
+		else
+			t->lt_nearest[v] = i;
+	}
+
+	return 0;
+}
+
+/* generate the table of 'n' levels from 0 to 100 at regular intervals */
+int
+level_table_generate(struct level_table *t, int n)
+{
+	int i, levels[LEVEL_MAXLEVELS];
+
+	if (n < 2 || n > LEVEL_MAXLEVELS)
+		return -1;
+	for (i = 0; i < n; i++)
+		levels[i] = (LEVEL_MAX * i + (n - 1) / 2) / (n - 1);
+	return level_table_init(t, levels, n);
+}
+
+static int
+clamp_level(int val)
+{
+	return MAX(0, MIN(val, LEVEL_MAX));
+}
+
+/* returns the index of the nearest level of the value */
+int
+level_index(const struct level_table *t, int val)
+{
+	return t->lt_nearest[clamp_level(val)];
+}
+
+/* returns the nearest level of the value */
+int
+level_nearest(const struct level_table *t, int val)
+{
+	return t->lt_levels[level_index(t, val)];
+}
+
+/* returns the level of 'percent' % between the minimum and maximum */
+int
+level_percent(const struct level_table *t, int percent)
+{
+	int min = t->lt_levels[0], max = t->lt_levels[t->lt_nlevels - 1];
+
+	return level_nearest(t, min + (max - min) *
+			     MAX(0, MIN(percent, 100)) / 100);
+}
+
+/*
+  Returns the level 'steps' levels above the current value, or below
+  if 'steps' is negative. The value that is not in the table counts
+  the level next to it as the first step.
+ */
+int
+level_step(const struct level_table *t, int val, int steps)
+{
+	int i, n = t->lt_nlevels;
+	int exact;
+
+	if (steps == 0)
+		return level_nearest(t, val);
+
+	/* more steps than the levels don't overflow */
+	steps = MAX(-n, MIN(steps, n));
+
+	val = clamp_level(val);
+	i = t->lt_ceil[val];
+	exact = (i < n && t->lt_levels[i] == val);
+
+	if (steps > 0)
+		i += exact ? steps : steps - 1;
+	else if (steps < 0) {
+		/* the largest index of the level not above the value */
+		if (! exact)
+			i--;
+		i += exact ? steps : steps + 1;
+	}
+
+	return t->lt_levels[MAX(0, MIN(i, n - 1))];
+}
+
+/*
+  Parse the curve and the number of steps such as "cie:16", the number
+  of steps may be omitted.
+ */
+int
+parse_curve(const char *arg)
+{
+	const char *p;
+	char *q;
+	size_t len;
+	long n = 0;
+	int i;
+
+	len = ((p = strchr(arg, ':')) != NULL) ? (size_t)(p - arg) :
+		strlen(arg);
+	for (i = 0; i < nitems(curve_names); i++)
+		if (strlen(curve_names[i]) == len &&
+		    strncmp(arg, curve_names[i], len) == 0)
+			break;
+	if (i == nitems(curve_names)) {
+		fprintf(stderr, "unknown curve: %s\n", arg);
+		return -1;
+	}
+
+	if (p != NULL) {
+		n = strtol(p + 1, &q, 10);
+		if (p[1] == '\0' || *q != '\0' || n < 1 ||
+		    n >= LEVEL_MAXLEVELS) {
+			fprintf(stderr, "invalid number of steps: %s\n",
+				p + 1);
+			return -1;
+		}
+	}
+
+	curve_type = i;
+	curve_steps = n;
+	return 0;
+}
+
+/* luminance of 'x' in 0..1 of the perceived brightness */
+static double
+curve_value(enum CURVE type, double x)
+{
+	double l = x * 100;
+
+	switch (type) {
+	case CURVE_GAMMA:
+		return pow(x, CURVE_GAMMA_EXP);
+	case CURVE_CIELAB:
+		/* inverse of CIE 1976 L* */
+		return (l > 8) ? pow((l + 16) / 116, 3) : l / 903.3;
+	default:
+		return x;
+	}
+}
+
+static int
+build_curve(struct level_table *t, enum CURVE type, int n)
+{
+	int i, levels[LEVEL_MAXLEVELS];
+
+	for (i = 0; i <= n; i++)
+		levels[i] = lround(LEVEL_MAX *
+				   curve_value(type, (double)i / n));
+	/* the steps at the low end may be merged */
+	return level_table_init(t, levels, n + 1);
+}
+
+/*
+  Returns the table of the current curve, or NULL if it can't be built.
+  'nsteps' is the default number of the steps of the driver.
+ */
+const struct level_table *
+level_curve(int nsteps)
+{
+	struct level_table **tp, *t;
+	int n = (curve_steps > 0) ? curve_steps : nsteps;
+
+	n = MAX(1, MIN(n, LEVEL_MAXLEVELS - 1));
+
+	pthread_mutex_lock(&curve_lock);
+	tp = &curve_tables[curve_type][n];
+	if (*tp == NULL) {
+		if ((t = malloc(sizeof(*t))) == NULL ||
+		    build_curve(t, curve_type, n) < 0) {
+			fprintf(stderr, "failed to build %s curve of %d steps\n",
+				curve_names[curve_type], n);
+			free(t);
+		} else
+			*tp = t;
+	}
+	t = *tp;
+	pthread_mutex_unlock(&curve_lock);
+	return t;
+}
+
+/*
+  Returns the level 'steps' steps of the curve away from the value.
+  The table 't' has the levels that the device accepts, or NULL if any
+  level is accepted. The result is snapped to the levels of the device
+  and is at least one level of the device away.
+  The levels of the device are stepped as ever without the curve given.
+ */
+int
+level_curve_step(const struct level_table *t, int nsteps, int val, int steps)
+{
+	const struct level_table *c;
+	int i, v, next;
+
+	if (curve_type == CURVE_LINEAR && curve_steps == 0) {
+		if (t != NULL)
+			return level_step(t, val, steps);
+		/* relative steps such as by 10 of the keyboard */
+		steps = MAX(-nsteps, MIN(steps, nsteps));
+		return clamp_level(val + steps * LEVEL_MAX / nsteps);
+	}
+
+	if ((c = level_curve(nsteps)) == NULL)
+		return (t != NULL) ? level_step(t, val, steps) :
+			clamp_level(val);
+	v = level_step(c, val, steps);
+	if (t == NULL || steps == 0)
+		return (t == NULL) ? v : level_nearest(t, v);
+
+	next = level_step(t, val, (steps > 0) ? 1 : -1);
+	i = t->lt_ceil[v];
+	if (steps > 0)
+		return MAX(t->lt_levels[MIN(i, t->lt_nlevels - 1)], next);
+
+	/* the largest level not above the value */
+	if (i == t->lt_nlevels || t->lt_levels[i] != v)
+		i--;
+	return MIN(t->lt_levels[MAX(i, 0)], next);
+}
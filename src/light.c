@@ -0,0 +1,264 @@
+/*-
+ * Copyright (c) 2026 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Auto-brightness by the ambient light sensors of asmc(4).
+ *
+ * asmctld(8) samples the left and the right sensors on a timer and
+ * smooths the brighter one by the exponential moving average. The LCD
+ * and the keyboard backlight follow their own curves of the smoothed
+ * light, and a level is written only if it moves by the threshold.
+ *
+ * The sampling interval is doubled while the light is stable, up to
+ * LIGHT_MAX_INTERVAL, and reset to LIGHT_MIN_INTERVAL on a change. The
+ * number of the samples and the writes are counted in the statistics.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "asmctl.h"
+
+#define LIGHT_LEFT   "dev.asmc.0.light.left"
+#define LIGHT_RIGHT  "dev.asmc.0.light.right"
+
+/* fixed point of the moving average, weight of a sample is 1/4 */
+#define LIGHT_SCALE  16
+#define LIGHT_SHIFT  2
+
+/* a sample differs from the average by 1/8, or by 4 in the dark */
+#define LIGHT_CHANGE(ema)  MAX((ema) / 8, 4)
+
+struct light_point {
+	int lp_light;
+	int lp_level;
+};
+
+/* the screen gets brighter in a bright room */
+static const struct light_point video_curve[] = {
+	{0, 10}, {20, 30}, {100, 60}, {400, 85}, {1000, 100},
+};
+
+/* the keys are lit only in a dark room */
+static const struct light_point keyboard_curve[] = {
+	{0, 60}, {20, 30}, {100, 0},
+};
+
+struct light_channel {
+	enum CATEGORY lc_category;
+	const struct light_point *lc_curve;
+	int lc_npoints;
+	int lc_threshold;
+	int lc_level[ASMC_MAXUNITS];  /* written by me, -1 if not yet */
+};
+
+static struct light_channel channels[] = {
+	{VIDEO, video_curve, nitems(video_curve), 10},
+	{KEYBOARD, keyboard_curve, nitems(keyboard_curve), 20},
+};
+
+int light_enabled = 0;
+
+static int light_ema = -1;  /* scaled by LIGHT_SCALE */
+static long light_interval = LIGHT_MIN_INTERVAL;
+static struct event_timer light_timer;
+
+static int
+read_sensor(const char *name, int *val)
+{
+	size_t buflen = sizeof(*val);
+
+	if (HW_SYSCTL(name, val, &buflen, NULL, 0) < 0) {
+		fprintf(stderr, "sysctl %s : %s\n", name, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* the brighter of the sensors, the other one may be covered by a hand */
+static int
+read_light(int *light)
+{
+	int left, right;
+
+	if (read_sensor(LIGHT_LEFT, &left) < 0 ||
+	    read_sensor(LIGHT_RIGHT, &right) < 0)
+		return -1;
+
+	*light = MAX(left, right);
+	return 0;
+}
+
+/* interpolate the curve linearly */
+static int
+curve_level(const struct light_point *curve, int npoints, int light)
+{
+	const struct light_point *p, *q;
+	int i;
+
+	if (light <= curve[0].lp_light)
+		return curve[0].lp_level;
+
+	for (i = 1; i < npoints; i++) {
+		p = &curve[i - 1];
+		q = &curve[i];
+		if (light < q->lp_light)
+			return p->lp_level + (q->lp_level - p->lp_level) *
+				(light - p->lp_light) /
+				(q->lp_light - p->lp_light);
+	}
+
+	return curve[npoints - 1].lp_level;
+}
+
+/*
+  Write the level if it moves by the threshold from the level that I
+  wrote last. The ends of the curve are always reached. A level that
+  the user sets is kept until the light changes enough.
+ */
+static int
+light_apply(struct light_channel *lc, int unit, int light, int *locked)
+{
+	struct asmc_driver_context *c = asmc_context(lc->lc_category, unit);
+	const struct light_point *curve = lc->lc_curve;
+	int level, rc, n = lc->lc_npoints, *last = &lc->lc_level[unit];
+
+	if (c->driver == NULL)
+		return 0;
+
+	/* the keyboard is lit on the next input */
+	if (lc->lc_category == KEYBOARD && idle_is_dimmed())
+		return 0;
+
+	level = curve_level(curve, n, light);
+	if (level == *last)
+		return 0;
+
+	if (*last >= 0 && abs(level - *last) < lc->lc_threshold &&
+	    level != curve[0].lp_level && level != curve[n - 1].lp_level)
+		return 0;
+
+	/*
+	  The levels are locked and loaded again before the first change,
+	  the next sample applies it while another process holds them.
+	 */
+	if (! *locked) {
+		if ((rc = conf_trylock(CATEGORY_ALL)) <= 0)
+			return rc;
+		*locked = 1;
+		if (get_saved_levels() < 0)
+			return -1;
+	}
+
+	/* the levels saved for the AC power status are left to the user */
+	if (ASMC_SET(c, level, ASMC_SET_PERCENT | ASMC_SET_CURRENT) < 0)
+		return -1;
+
+	*last = level;
+	conf_count(STAT_LIGHT_WRITES, 1);
+	return 1;
+}
+
+/*
+  Take a sample and apply it to the backlights.
+  Returns the interval to the next sample in milliseconds.
+ */
+long
+light_sample(void)
+{
+	struct light_channel *lc;
+	int light, unit, changed = 0, locked = 0;
+
+	if (read_light(&light) < 0)
+		return LIGHT_MAX_INTERVAL;
+	conf_count(STAT_LIGHT_SAMPLES, 1);
+
+	if (light_ema < 0)
+		light_ema = light * LIGHT_SCALE;
+	else {
+		if (abs(light - light_ema / LIGHT_SCALE) >
+		    LIGHT_CHANGE(light_ema / LIGHT_SCALE))
+			light_interval = LIGHT_MIN_INTERVAL;
+		else
+			light_interval = MIN(light_interval * 2,
+					     LIGHT_MAX_INTERVAL);
+		light_ema += (light * LIGHT_SCALE - light_ema) >> LIGHT_SHIFT;
+	}
+
+	ARRAY_FOREACH(lc, channels)
+		for (unit = 0; unit < ASMC_MAXUNITS; unit++)
+			if (light_apply(lc, unit, light_ema / LIGHT_SCALE,
+					&locked) > 0)
+				changed = 1;
+
+	if (changed)
+		store_conf_file();
+	if (locked)
+		conf_unlock(CATEGORY_ALL);
+
+	return light_interval;
+}
+
+static void
+on_light(void *arg)
+{
+	event_timer_set(&light_timer, light_sample());
+}
+
+/* start sampling on the event loop */
+int
+light_start(void)
+{
+	struct light_channel *lc;
+	int light, unit;
+
+	if (read_light(&light) < 0) {
+		fprintf(stderr, "no ambient light sensor is found\n");
+		return -1;
+	}
+
+	ARRAY_FOREACH(lc, channels)
+		for (unit = 0; unit < ASMC_MAXUNITS; unit++)
+			lc->lc_level[unit] = -1;
+
+	event_timer_init(&light_timer, on_light, NULL);
+	event_timer_set(&light_timer, 0);
+	return 0;
+}
+
+#ifdef USE_CAPSICUM
+void
+light_cap_set_rights(cap_sysctl_limit_t *limits)
+{
+	hw_sysctl_limit(limits, LIGHT_LEFT, CAP_SYSCTL_READ);
+	hw_sysctl_limit(limits, LIGHT_RIGHT, CAP_SYSCTL_READ);
+}
+#endif
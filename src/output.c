@@ -0,0 +1,225 @@
+/*-
+ * Copyright (c) 2026 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Output of the levels changed by an invocation.
+ *
+ * The messages of the drivers are buffered and written to the standard
+ * output by one write(2), or sent back to asmctl(1) in the reply of
+ * asmctld(8). In JSON mode, the levels of each device before and after
+ * the command are written in one line instead of the messages. Nothing
+ * is buffered in quiet mode.
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+#include <unistd.h>
+
+#include "asmctl.h"
+
+enum OUTPUT output_mode = OUTPUT_TEXT;
+
+/* the drivers run on the threads in a batch */
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+static char output_buf[OUTPUT_BUFSIZE];
+static size_t output_len = 0;
+static int output_nrecords = 0;
+static int output_is_coalesced = 0;
+
+/* called with output_lock held, the overflow is truncated */
+static void
+output_vappend(const char *fmt, va_list ap)
+{
+	int n;
+
+	if (output_len >= sizeof(output_buf) - 1)
+		return;
+	n = vsnprintf(&output_buf[output_len], sizeof(output_buf) - output_len,
+		      fmt, ap);
+	if (n > 0)
+		output_len = MIN(output_len + n, sizeof(output_buf) - 1);
+}
+
+static void
+output_append(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	output_vappend(fmt, ap);
+	va_end(ap);
+}
+
+/* a message of the driver such as "set video brightness: 50" */
+void
+output_text(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (output_mode != OUTPUT_TEXT)
+		return;
+
+	pthread_mutex_lock(&output_lock);
+	va_start(ap, fmt);
+	output_vappend(fmt, ap);
+	va_end(ap);
+	pthread_mutex_unlock(&output_lock);
+}
+
+/* the unknown level is null */
+static void
+output_level(const char *key, int val)
+{
+	if (val < 0)
+		output_append(",\"%s\":null", key);
+	else
+		output_append(",\"%s\":%d", key, val);
+}
+
+/* the levels of the device before and after the command */
+void
+output_levels(const struct asmc_driver_context *c,
+	      const struct asmc_levels *old, const struct asmc_levels *new)
+{
+	if (output_mode != OUTPUT_JSON)
+		return;
+
+	pthread_mutex_lock(&output_lock);
+	output_append("%s{\"category\":\"%s\",\"unit\":%d,\"driver\":\"%s\"",
+		      (output_nrecords++ > 0) ? "," : "",
+		      asmc_category_name(c->category), c->unit,
+		      c->driver->name);
+	output_level("old", old->al_current);
+	output_level("new", new->al_current);
+	output_level("economy", new->al_economy);
+	output_level("fullpower", new->al_fullpower);
+	output_append("}");
+	pthread_mutex_unlock(&output_lock);
+}
+
+/* the levels saved in the state file and the one of the hardware */
+void
+output_status(enum CATEGORY cat, int unit, const char *driver,
+	      const struct asmc_levels *l, int hw)
+{
+	char buf[3][12];
+	int i, v[] = {l->al_current, l->al_economy, l->al_fullpower};
+
+	pthread_mutex_lock(&output_lock);
+	switch (output_mode) {
+	case OUTPUT_TEXT:
+		for (i = 0; i < nitems(v); i++)
+			if (v[i] < 0)
+				strlcpy(buf[i], "-", sizeof(buf[i]));
+			else
+				snprintf(buf[i], sizeof(buf[i]), "%d", v[i]);
+		output_append("%s:%d %s: %s (economy %s, fullpower %s",
+			      asmc_category_name(cat), unit, driver,
+			      buf[0], buf[1], buf[2]);
+		if (hw >= 0)
+			output_append(", hardware %d", hw);
+		output_append(")\n");
+		break;
+	case OUTPUT_JSON:
+		output_append("%s{\"category\":\"%s\",\"unit\":%d,"
+			      "\"driver\":\"%s\"",
+			      (output_nrecords++ > 0) ? "," : "",
+			      asmc_category_name(cat), unit, driver);
+		output_level("current", l->al_current);
+		output_level("economy", l->al_economy);
+		output_level("fullpower", l->al_fullpower);
+		if (hw >= 0)
+			output_level("hardware", hw);
+		output_append("}");
+		break;
+	default:
+		break;
+	}
+	pthread_mutex_unlock(&output_lock);
+}
+
+/*
+  Copy the output to 'buf' and clear it.
+  Returns the length of the output.
+ */
+size_t
+output_get(char *buf, size_t size)
+{
+	int n = 0;
+
+	pthread_mutex_lock(&output_lock);
+	switch (output_mode) {
+	case OUTPUT_TEXT:
+		n = snprintf(buf, size, "%.*s", (int)output_len, output_buf);
+		break;
+	case OUTPUT_JSON:
+		n = snprintf(buf, size, "{\"ac_powered\":%s,%s\"devices\":"
+			     "[%.*s]}\n", (ac_powered < 0) ? "null" :
+			     ac_powered ? "true" : "false",
+			     output_is_coalesced ? "\"coalesced\":true," : "",
+			     (int)output_len, output_buf);
+		break;
+	default:
+		break;
+	}
+	output_len = 0;
+	output_nrecords = 0;
+	output_is_coalesced = 0;
+	pthread_mutex_unlock(&output_lock);
+
+	return (n < 0) ? 0 : MIN((size_t)n, size - 1);
+}
+
+/* the steps are passed to another process, no device is changed by me */
+void
+output_coalesced(void)
+{
+	pthread_mutex_lock(&output_lock);
+	output_is_coalesced = 1;
+	pthread_mutex_unlock(&output_lock);
+}
+
+/* write the output in one write(2) */
+int
+output_write(int fd)
+{
+	char buf[OUTPUT_BUFSIZE + OUTPUT_JSON_EXTRA];
+	size_t len;
+
+	if ((len = output_get(buf, sizeof(buf))) == 0)
+		return 0;
+	if (write(fd, buf, len) < 0) {
+		fprintf(stderr, "write: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
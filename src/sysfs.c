@@ -0,0 +1,567 @@
+/*-
+ * Copyright (c) 2026 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Linux sysfs backlight drivers.
+ *
+ *  /sys/class/backlight/<device>	(display)
+ *  /sys/class/leds/<device>::kbd_backlight (keyboard)
+ *  /sys/class/power_supply/<device>	(AC adapter)
+ *
+ * The 'brightness' file is kept opened and is read and written by
+ * pread(2)/pwrite(2). The raw value from 0 to 'max_brightness' is
+ * scaled to the levels from 0 to 100.
+ *
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <unistd.h>
+
+#include "asmctl.h"
+
+#define SYSFS_BRIGHTNESS      "brightness"
+#define SYSFS_MAX_BRIGHTNESS  "max_brightness"
+
+/* root directory of sysfs, it can be a fake tree for testing */
+char *sysfs_root = "/sys";
+
+struct sysfs_class {
+	const char *sk_class;
+	const char *sk_suffix;
+	const char *sk_message;
+	const char *sk_eco_level;
+	const char *sk_ful_level;
+	const char *sk_cur_level;
+	int sk_nsteps;
+};
+
+static const struct sysfs_class sysfs_backlight_class = {
+	.sk_class = "backlight",
+	.sk_suffix = "",
+	.sk_message = "set backlight brightness",
+	.sk_eco_level = "sysfs_backlight_economy_level",
+	.sk_ful_level = "sysfs_backlight_full_level",
+	.sk_cur_level = "sysfs_backlight_current_level",
+	.sk_nsteps = 20,
+};
+
+static const struct sysfs_class sysfs_kbd_class = {
+	.sk_class = "leds",
+	.sk_suffix = "::kbd_backlight",
+	.sk_message = "set keyboard backlight brightness",
+	.sk_eco_level = "sysfs_kbd_economy_level",
+	.sk_ful_level = "sysfs_kbd_full_level",
+	.sk_cur_level = "sysfs_kbd_current_level",
+	.sk_nsteps = 10,
+};
+
+struct sysfs_context {
+	const struct sysfs_class *sc_class;
+	int sc_economy_level;
+	int sc_fullpower_level;
+	int sc_current_level;
+	int sc_fd;
+	int sc_max;
+	int sc_raw;
+	struct level_table sc_table;
+	const struct level_table *sc_levels;
+	struct fade sc_fade;
+};
+
+static int write_sysfs_level(void *, int);
+
+static int
+read_number(int fd, int *val)
+{
+	char buf[16], *p;
+	ssize_t len;
+	long v;
+
+	if ((len = HW_PREAD(fd, buf, sizeof(buf) - 1, 0)) <= 0)
+		return -1;
+	buf[len] = '\0';
+
+	v = strtol(buf, &p, 10);
+	if (p == buf || v < 0 || v > INT_MAX)
+		return -1;
+	*val = v;
+	return 0;
+}
+
+static int
+write_number(int fd, int val)
+{
+	char buf[16];
+	size_t i = sizeof(buf);
+
+	buf[--i] = '\n';
+	do {
+		buf[--i] = '0' + val % 10;
+		val /= 10;
+	} while (val > 0);
+
+	return (HW_PWRITE(fd, &buf[i], sizeof(buf) - i, 0) ==
+		sizeof(buf) - i) ? 0 : -1;
+}
+
+static int
+has_suffix(const char *name, const char *suffix)
+{
+	size_t n = strlen(name), s = strlen(suffix);
+
+	return n > s && strcmp(&name[n - s], suffix) == 0;
+}
+
+/* find the device of the class, the first one in alphabetical order. */
+static int
+find_device(const struct sysfs_class *k, char *path, size_t len)
+{
+	char dir[PATH_MAX], name[NAME_MAX + 1] = "";
+	struct dirent *e;
+	DIR *d;
+
+	if (snprintf(dir, sizeof(dir), "%s/class/%s", sysfs_root,
+		     k->sk_class) >= sizeof(dir))
+		return -1;
+
+	if ((d = opendir(dir)) == NULL)
+		return -1;
+	while ((e = readdir(d)) != NULL) {
+		if (e->d_name[0] == '.' || ! has_suffix(e->d_name, k->sk_suffix))
+			continue;
+		if (name[0] == '\0' || strcmp(e->d_name, name) < 0)
+			strlcpy(name, e->d_name, sizeof(name));
+	}
+	closedir(d);
+
+	if (name[0] == '\0' ||
+	    snprintf(path, len, "%s/%s", dir, name) >= len)
+		return -1;
+	return 0;
+}
+
+static int
+open_attribute(const char *dir, const char *attr, int flags)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir, attr) >= sizeof(path))
+		return -1;
+	return HW_OPEN(path, flags | O_CLOEXEC);
+}
+
+/* read a short attribute that is not kept opened. */
+static int
+read_attribute(const char *dir, const char *attr, char *buf, size_t len)
+{
+	ssize_t n;
+	int fd;
+
+	if ((fd = open_attribute(dir, attr, O_RDONLY)) < 0)
+		return -1;
+	n = HW_PREAD(fd, buf, len - 1, 0);
+	HW_CLOSE(fd);
+	if (n < 0)
+		return -1;
+	buf[n] = '\0';
+	return 0;
+}
+
+/*
+  Find the AC adapter that has the type 'Mains'. A system without it
+  is regarded as AC powered.
+ */
+int
+sysfs_get_ac_powered(int *powered)
+{
+	char dir[PATH_MAX], path[PATH_MAX], buf[16];
+	struct dirent *e;
+	DIR *d;
+
+	*powered = 1;
+
+	if (snprintf(dir, sizeof(dir), "%s/class/power_supply",
+		     sysfs_root) >= sizeof(dir) ||
+	    (d = opendir(dir)) == NULL)
+		return 0;
+
+	while ((e = readdir(d)) != NULL) {
+		if (e->d_name[0] == '.' ||
+		    snprintf(path, sizeof(path), "%s/%s", dir, e->d_name) >=
+		    sizeof(path))
+			continue;
+		if (read_attribute(path, "type", buf, sizeof(buf)) < 0 ||
+		    strncmp(buf, "Mains", 5) != 0 ||
+		    read_attribute(path, "online", buf, sizeof(buf)) < 0)
+			continue;
+		*powered = (buf[0] == '1');
+		break;
+	}
+	closedir(d);
+
+	return 0;
+}
+
+static int
+sysfs_init(struct sysfs_context *c, const struct sysfs_class *k)
+{
+	char dir[PATH_MAX];
+	int fd, rc;
+
+	c->sc_class = k;
+	c->sc_fd = -1;
+	c->sc_raw = -1;
+	c->sc_economy_level = -1;
+	c->sc_fullpower_level = -1;
+	c->sc_current_level = -1;
+
+	/* may fail */
+	if (find_device(k, dir, sizeof(dir)) < 0)
+		return -1;
+
+	if ((fd = open_attribute(dir, SYSFS_MAX_BRIGHTNESS, O_RDONLY)) < 0)
+		return -1;
+	rc = read_number(fd, &c->sc_max);
+	HW_CLOSE(fd);
+	if (rc < 0 || c->sc_max < 1)
+		return -1;
+
+	if ((c->sc_fd = open_attribute(dir, SYSFS_BRIGHTNESS, O_RDWR)) < 0)
+		return -1;
+
+	/* a device with a few raw levels has the steps of them */
+	c->sc_levels = NULL;
+	if (c->sc_max < k->sk_nsteps &&
+	    level_table_generate(&c->sc_table, c->sc_max + 1) == 0)
+		c->sc_levels = &c->sc_table;
+	fade_init(&c->sc_fade, write_sysfs_level, c);
+
+	return 0;
+}
+
+/* the first device of the class only */
+static int
+sysfs_backlight_init(void *context, int unit)
+{
+	return (unit > 0) ? -1 : sysfs_init(context, &sysfs_backlight_class);
+}
+
+static int
+sysfs_kbd_init(void *context, int unit)
+{
+	return (unit > 0) ? -1 : sysfs_init(context, &sysfs_kbd_class);
+}
+
+static int
+sysfs_load_conf(void *context, nvlist_t *cf)
+{
+	struct sysfs_context *c = context;
+	const struct sysfs_class *k = c->sc_class;
+
+	if (conf_get_int(cf, k->sk_eco_level, &c->sc_economy_level) < 0 ||
+	    conf_get_int(cf, k->sk_ful_level, &c->sc_fullpower_level) < 0 ||
+	    conf_get_int(cf, k->sk_cur_level, &c->sc_current_level) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int
+sysfs_save_conf(void *context, nvlist_t *cf)
+{
+	struct sysfs_context *c = context;
+	const struct sysfs_class *k = c->sc_class;
+
+	nvlist_add_number(cf, k->sk_eco_level, c->sc_economy_level);
+	nvlist_add_number(cf, k->sk_ful_level, c->sc_fullpower_level);
+	nvlist_add_number(cf, k->sk_cur_level, c->sc_current_level);
+
+	return 0;
+}
+
+#ifdef USE_CAPSICUM
+static int
+sysfs_cap_set_rights(void *context, cap_sysctl_limit_t *limits)
+{
+	return 0;
+}
+#endif
+
+static int
+sysfs_cleanup(void *context)
+{
+	struct sysfs_context *c = context;
+
+	if (c->sc_fd != -1) {
+		HW_CLOSE(c->sc_fd);
+		c->sc_fd = -1;
+	}
+	return 0;
+}
+
+static int
+to_raw(const struct sysfs_context *c, int val)
+{
+	return (val * c->sc_max + 50) / 100;
+}
+
+static int
+to_level(const struct sysfs_context *c, int raw)
+{
+	return (MIN(raw, c->sc_max) * 100 + c->sc_max / 2) / c->sc_max;
+}
+
+/* read the current level that may be changed by the firmware */
+static int
+get_sysfs_level(struct sysfs_context *c)
+{
+	int raw, val, rc;
+	struct trace_mark tm;
+
+	/* the target of the fade is the current level */
+	if (fade_is_active(&c->sc_fade))
+		return 0;
+
+	trace_begin(&tm, PHASE_LEVELS);
+	rc = read_number(c->sc_fd, &raw);
+	trace_end(&tm);
+	if (rc < 0) {
+		fprintf(stderr, "can not read %s: %s\n", SYSFS_BRIGHTNESS,
+			strerror(errno));
+		return -1;
+	}
+	c->sc_raw = raw;
+	val = to_level(c, raw);
+
+	if (c->sc_economy_level < 0)
+		conf_set_int(&c->sc_economy_level, val);
+	if (c->sc_fullpower_level < 0)
+		conf_set_int(&c->sc_fullpower_level, val);
+	conf_set_int(&c->sc_current_level, val);
+
+	return 0;
+}
+
+/* write the brightness, called for each frame of the fade */
+static int
+write_sysfs_level(void *context, int val)
+{
+	struct sysfs_context *c = context;
+	int raw = to_raw(c, val);
+
+	/* levels closer than a raw step */
+	if (raw == c->sc_raw) {
+		conf_count(STAT_HW_WRITES_SKIPPED, 1);
+		return 0;
+	}
+
+	if (write_number(c->sc_fd, raw) < 0) {
+		fprintf(stderr, "can not write %s: %s\n", SYSFS_BRIGHTNESS,
+			strerror(errno));
+		return -1;
+	}
+	conf_count(STAT_HW_WRITES, 1);
+	c->sc_raw = raw;
+
+	return 0;
+}
+
+/*
+  Set the level. The level for the AC power status is kept with
+  ASMC_SET_CURRENT.
+ */
+static int
+set_sysfs_level(struct sysfs_context *c, int val, int flags)
+{
+	if (val < 0 || val > 100)
+		return -1;
+
+	/* skip writing the same level */
+	if (val == c->sc_current_level)
+		conf_count(STAT_HW_WRITES_SKIPPED, 1);
+	else if (fade_to(&c->sc_fade, c->sc_current_level, val) < 0)
+		return -1;
+
+	output_text("%s: %d\n", c->sc_class->sk_message, val);
+
+	conf_set_int(&c->sc_current_level, val);
+	if (flags & ASMC_SET_CURRENT)
+		return 0;
+
+	if (ac_powered)
+		conf_set_int(&c->sc_fullpower_level, val);
+	else
+		conf_set_int(&c->sc_economy_level, val);
+
+	return 0;
+}
+
+static int
+sysfs_event(void *context)
+{
+	struct sysfs_context *c = context;
+
+	/* the levels are not saved yet */
+	if (get_sysfs_level(c) < 0)
+		return -1;
+
+	return set_sysfs_level(c, choose_acpi_level(c->sc_economy_level,
+						    c->sc_fullpower_level), 0);
+}
+
+static int
+sysfs_up(void *context, int steps)
+{
+	struct sysfs_context *c = context;
+
+	if (get_sysfs_level(c) < 0)
+		return -1;
+
+	return set_sysfs_level(c, level_curve_step(c->sc_levels,
+		c->sc_class->sk_nsteps, c->sc_current_level, steps), 0);
+}
+
+static int
+sysfs_down(void *context, int steps)
+{
+	struct sysfs_context *c = context;
+
+	if (get_sysfs_level(c) < 0)
+		return -1;
+
+	return set_sysfs_level(c, level_curve_step(c->sc_levels,
+		c->sc_class->sk_nsteps, c->sc_current_level, -steps), 0);
+}
+
+/*
+  Any level in 0..100 is accepted, to_raw() scales it to max_brightness
+  which makes it the percentage as well. The few levels of a small
+  max_brightness are looked up in the table.
+ */
+static int
+sysfs_set(void *context, int val, int flags)
+{
+	struct sysfs_context *c = context;
+
+	if (get_sysfs_level(c) < 0)
+		return -1;
+
+	val = MAX(0, MIN(val, 100));
+	if (c->sc_levels != NULL)
+		val = (flags & ASMC_SET_PERCENT) ?
+			level_percent(c->sc_levels, val) :
+			level_nearest(c->sc_levels, val);
+
+	return set_sysfs_level(c, val, flags & ASMC_SET_CURRENT);
+}
+
+static int
+sysfs_get_levels(void *context, struct asmc_levels *l)
+{
+	struct sysfs_context *c = context;
+
+	l->al_current = c->sc_current_level;
+	l->al_economy = c->sc_economy_level;
+	l->al_fullpower = c->sc_fullpower_level;
+	return 0;
+}
+
+static int
+sysfs_read_level(void *context, int *val)
+{
+	struct sysfs_context *c = context;
+	int raw;
+
+	if (read_number(c->sc_fd, &raw) < 0) {
+		fprintf(stderr, "can not read %s: %s\n", SYSFS_BRIGHTNESS,
+			strerror(errno));
+		return -1;
+	}
+	*val = to_level(c, raw);
+	return 0;
+}
+
+/* fade to 0 while idle and back, the current level is kept */
+static int
+sysfs_dim(void *context, int dim)
+{
+	struct sysfs_context *c = context;
+
+	if (c->sc_current_level <= 0)
+		return 0;
+
+	return dim ? fade_to(&c->sc_fade, c->sc_current_level, 0) :
+		fade_to(&c->sc_fade, 0, c->sc_current_level);
+}
+
+struct asmc_driver sysfs_backlight_driver =
+{
+	.name = "sysfs_backlight",
+	.category = VIDEO,
+	.ctx_size = sizeof(struct sysfs_context),
+	.init = sysfs_backlight_init,
+	.load_conf = sysfs_load_conf,
+	.save_conf = sysfs_save_conf,
+#ifdef USE_CAPSICUM
+	.cap_set_rights = sysfs_cap_set_rights,
+#endif
+	.cleanup = sysfs_cleanup,
+	.acpi_event = sysfs_event,
+	.up = sysfs_up,
+	.down = sysfs_down,
+	.set = sysfs_set,
+	.get_levels = sysfs_get_levels,
+	.read_level = sysfs_read_level
+};
+
+struct asmc_driver sysfs_kbd_driver =
+{
+	.name = "sysfs_kbd",
+	.category = KEYBOARD,
+	.ctx_size = sizeof(struct sysfs_context),
+	.init = sysfs_kbd_init,
+	.load_conf = sysfs_load_conf,
+	.save_conf = sysfs_save_conf,
+#ifdef USE_CAPSICUM
+	.cap_set_rights = sysfs_cap_set_rights,
+#endif
+	.cleanup = sysfs_cleanup,
+	.acpi_event = sysfs_event,
+	.up = sysfs_up,
+	.down = sysfs_down,
+	.set = sysfs_set,
+	.get_levels = sysfs_get_levels,
+	.read_level = sysfs_read_level,
+	.dim = sysfs_dim
+};
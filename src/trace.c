@@ -0,0 +1,140 @@
+/*-
+ * Copyright (c) 2026 Yuichiro NAITO <naito.yuichiro@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Timing trace of an invocation.
+ *
+ * Each phase accumulates the time between trace_begin() and
+ * trace_end() by CLOCK_MONOTONIC. A phase can be nested in another,
+ * the time of the inner phase is included in the outer one, and the
+ * system calls are counted for the innermost phase only.
+ *
+ */
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "asmctl.h"
+
+struct trace_phase {
+	_Atomic uint64_t tp_nsec;
+	atomic_uint tp_syscalls;
+};
+
+static const char *phase_names[] = {
+	[PHASE_OTHER] = "other",
+	[PHASE_REQUEST] = "request",
+	[PHASE_PROBE] = "probe",
+	[PHASE_OPEN] = "open",
+	[PHASE_CAPSICUM] = "capsicum",
+	[PHASE_AC] = "ac",
+	[PHASE_LOAD] = "load",
+	[PHASE_OPERATE] = "operate",
+	[PHASE_LEVELS] = "levels",
+	[PHASE_WRITE] = "write",
+	[PHASE_STORE] = "store",
+};
+
+/* set 1 to record the time */
+int trace_enabled = 0;
+
+static struct trace_phase phases[PHASE_MAX];
+/* the drivers run on the threads in a batch */
+static _Thread_local enum PHASE current_phase = PHASE_OTHER;
+static struct timespec trace_start;
+
+static uint64_t
+elapsed_nsec(const struct timespec *from)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - from->tv_sec) * 1000000000ULL +
+		now.tv_nsec - from->tv_nsec;
+}
+
+void
+trace_init(void)
+{
+	trace_enabled = 1;
+	clock_gettime(CLOCK_MONOTONIC, &trace_start);
+}
+
+void
+trace_begin(struct trace_mark *m, enum PHASE p)
+{
+	m->tm_prev = current_phase;
+	current_phase = p;
+	if (trace_enabled)
+		clock_gettime(CLOCK_MONOTONIC, &m->tm_start);
+}
+
+void
+trace_end(struct trace_mark *m)
+{
+	if (trace_enabled)
+		atomic_fetch_add_explicit(&phases[current_phase].tp_nsec,
+					  elapsed_nsec(&m->tm_start),
+					  memory_order_relaxed);
+	current_phase = m->tm_prev;
+}
+
+/* count a system call of the current phase */
+void
+trace_syscall(void)
+{
+	atomic_fetch_add_explicit(&phases[current_phase].tp_syscalls, 1,
+				  memory_order_relaxed);
+}
+
+/*
+  Print the trace in one line of 'key=value's, such as
+
+  trace total_ns=52000 probe_ns=8000 probe_sys=3 ...
+ */
+void
+trace_print(FILE *fp)
+{
+	char buf[1024];
+	size_t len;
+	int i;
+
+	len = snprintf(buf, sizeof(buf), "trace total_ns=%" PRIu64,
+		       elapsed_nsec(&trace_start));
+	for (i = PHASE_OTHER + 1; i < PHASE_MAX && len < sizeof(buf); i++)
+		len += snprintf(&buf[len], sizeof(buf) - len,
+				" %s_ns=%" PRIu64 " %s_sys=%u",
+				phase_names[i], atomic_load(&phases[i].tp_nsec),
+				phase_names[i], atomic_load(&phases[i].tp_syscalls));
+	if (len < sizeof(buf))
+		snprintf(&buf[len], sizeof(buf) - len, " other_sys=%u",
+			 atomic_load(&phases[PHASE_OTHER].tp_syscalls));
+
+	fprintf(fp, "%s\n", buf);
+}